@@ -1,58 +1,287 @@
 // vim: set sw=2 expandtab :
 #include "hep_concurrency/SerialTaskQueue.h"
+#include "hep_concurrency/hardware_pause.h"
+#include "tbb/task.h"
 
 namespace hep::concurrency {
 
+  namespace {
+    // Set while push(...) executes a task directly
+    thread_local bool executing_pushed_task{false};
+  }
+
+  SerialTaskQueue::SerialTaskQueue(tbb::task_group& group)
+    : SerialTaskQueue{group, {.max_tasks = 0u, .run_on_push = false}}
+  {}
+
+  // Tasks that have not been started when the queue is destroyed are
+  // discarded along with the node pool.
+  SerialTaskQueue::SerialTaskQueue(tbb::task_group& group,
+                                   inline_execution const options)
+    : group_{&group}
+    , max_inline_tasks_{options.max_tasks}
+    , max_inline_time_{options.max_time}
+    , run_on_push_{options.run_on_push}
+  {
+    for (auto& l : lanes_) {
+      auto* const stub = acquire_node_();
+      l.head = stub;
+      l.tail = stub;
+    }
+  }
+
+  void
+  SerialTaskQueue::enable_metrics(std::string name)
+  {
+    metrics_ = std::make_unique<detail::serial_queue_recorder>(std::move(name));
+  }
+
+  serial_queue_metrics
+  SerialTaskQueue::metrics() const
+  {
+    if (metrics_ == nullptr) {
+      return {};
+    }
+    return metrics_->snapshot();
+  }
+
   bool
   SerialTaskQueue::pause()
   {
-    std::lock_guard sentry{mutex_};
-    return ++pauseCount_ == 1;
+    if (state_.fetch_add(one_pause) / one_pause != 0u) {
+      return false;
+    }
+    if (metrics_) {
+      metrics_->paused();
+    }
+    return true;
   }
 
   bool
   SerialTaskQueue::resume()
   {
-    std::lock_guard sentry{mutex_};
-    if (--pauseCount_ != 0) {
+    if (state_.fetch_sub(one_pause) / one_pause != 1u) {
       return false;
     }
-
-    if (auto next_task = pickNextTask()) {
-      group_->run(*next_task);
+    if (metrics_) {
+      metrics_->resumed();
     }
+    start_if_ready_();
     return true;
   }
 
-  auto
-  SerialTaskQueue::pickNextTask() -> task_ptr_t
+  void
+  SerialTaskQueue::notify_and_run_()
   {
-    std::lock_guard sentry{mutex_};
-    if ((pauseCount_ == 0) && !taskRunning_) {
-      if (!taskQueue_.empty()) {
-        auto ret = taskQueue_.front();
-        taskQueue_.pop();
-        taskRunning_ = true;
-        return ret;
+    // The calling task still owns the running flag, so the next task
+    // can be started without releasing it, unless the queue has been
+    // paused.
+    if (state_.load() == running) {
+      if (queued_task task; dequeue_(task)) {
+        run_(std::move(task));
+        return;
       }
     }
-    return nullptr;
+    state_.fetch_and(~running);
+    start_if_ready_();
+  }
+
+  void
+  SerialTaskQueue::start_if_ready_(bool const from_push)
+  {
+    while (not empty_()) {
+      std::uint64_t expected{0u};
+      if (not state_.compare_exchange_strong(expected, running)) {
+        // Either a task is running, which starts the next one upon
+        // completion, or the queue is paused.
+        return;
+      }
+      queued_task task;
+      if (not dequeue_(task)) {
+        // The previous owner of the running flag took the last task.
+        state_.fetch_and(~running);
+        continue;
+      }
+      if (from_push and run_on_push_ and not executing_pushed_task and
+          tbb::task::current_context() != nullptr) {
+        executing_pushed_task = true;
+        execute_(task);
+        executing_pushed_task = false;
+      } else {
+        run_(std::move(task));
+      }
+      return;
+    }
+  }
+
+  void
+  SerialTaskQueue::run_(queued_task task)
+  {
+    group_->run([this, t = std::move(task)] { execute_(t); });
+  }
+
+  // To be called only by the owner of the running flag
+  void
+  SerialTaskQueue::execute_(queued_task const& task)
+  {
+    invoke_(task);
+    if (max_inline_tasks_ != 0u) {
+      auto const deadline = clock::now() + max_inline_time_;
+      queued_task next;
+      for (unsigned int n{}; n != max_inline_tasks_; ++n) {
+        if (state_.load() != running or clock::now() >= deadline or
+            not dequeue_(next)) {
+          break;
+        }
+        invoke_(next);
+      }
+    }
+    notify_and_run_();
+  }
+
+  void
+  SerialTaskQueue::invoke_(queued_task const& task) noexcept
+  {
+    clock::time_point start;
+    if (metrics_) {
+      start = clock::now();
+      metrics_->record_wait(start - task.pushed);
+    }
+    try {
+      task.func();
+    }
+    catch (...) {
+    }
+    if (metrics_) {
+      metrics_->record_run(clock::now() - start);
+    }
   }
 
   auto
-  SerialTaskQueue::notify() -> task_ptr_t
+  SerialTaskQueue::acquire_node_() -> node*
   {
-    std::lock_guard sentry{mutex_};
-    taskRunning_ = false;
-    return pickNextTask();
+    auto head = free_head_.load();
+    while (true) {
+      auto const index = static_cast<std::uint32_t>(head);
+      if (index == 0u) {
+        auto const it = nodes_.grow_by(1);
+        it->index = static_cast<std::uint32_t>(it - nodes_.begin());
+        return &*it;
+      }
+      auto& n = nodes_[index - 1];
+      auto const next_free = n.next_free.load(std::memory_order_relaxed);
+      auto const count = (head >> 32) + 1u;
+      if (free_head_.compare_exchange_weak(head, count << 32 | next_free)) {
+        n.next.store(nullptr, std::memory_order_relaxed);
+        return &n;
+      }
+      if (metrics_) {
+        metrics_->contended();
+      }
+    }
   }
 
   void
-  SerialTaskQueue::notify_and_run()
+  SerialTaskQueue::release_node_(node* const n) noexcept
+  {
+    auto head = free_head_.load();
+    while (true) {
+      n->next_free.store(static_cast<std::uint32_t>(head),
+                         std::memory_order_relaxed);
+      auto const next = ((head >> 32) + 1u) << 32 | (n->index + 1u);
+      if (free_head_.compare_exchange_weak(head, next)) {
+        return;
+      }
+      if (metrics_) {
+        metrics_->contended();
+      }
+    }
+  }
+
+  void
+  SerialTaskQueue::enqueue_(detail::serial_task func,
+                            task_priority const priority)
+  {
+    auto* const n = acquire_node_();
+    n->task.func = std::move(func);
+    if (metrics_) {
+      n->task.pushed = clock::now();
+      metrics_->pushed();
+    }
+    auto& l = lanes_[static_cast<std::size_t>(priority)];
+    auto* const previous = l.head.exchange(n);
+    previous->next.store(n, std::memory_order_release);
+  }
+
+  bool
+  SerialTaskQueue::empty_() const noexcept
   {
-    if (auto next_task = notify()) {
-      group_->run(*next_task);
+    for (auto const& l : lanes_) {
+      if (l.head.load() != l.tail.load(std::memory_order_relaxed)) {
+        return false;
+      }
     }
+    return true;
+  }
+
+  // To be called only by the owner of the running flag.
+  bool
+  SerialTaskQueue::dequeue_(queued_task& task) noexcept
+  {
+    auto const waiting = [](lane const& l) {
+      return l.head.load() != l.tail.load(std::memory_order_relaxed);
+    };
+    if (max_overtakes_ != 0u) {
+      for (auto& l : lanes_) {
+        if (l.overtaken >= max_overtakes_ and waiting(l)) {
+          l.overtaken = 0u;
+          return dequeue_from_(l, task);
+        }
+      }
+    }
+    for (auto i = n_lanes; i-- != 0u;) {
+      if (not waiting(lanes_[i])) {
+        continue;
+      }
+      if (max_overtakes_ != 0u) {
+        lanes_[i].overtaken = 0u;
+        for (auto j = i; j-- != 0u;) {
+          if (waiting(lanes_[j])) {
+            ++lanes_[j].overtaken;
+          }
+        }
+      }
+      return dequeue_from_(lanes_[i], task);
+    }
+    return false;
+  }
+
+  bool
+  SerialTaskQueue::dequeue_from_(lane& l, queued_task& task) noexcept
+  {
+    auto* const tail = l.tail.load(std::memory_order_relaxed);
+    auto* next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      if (l.head.load() == tail) {
+        return false;
+      }
+      // A producer has swapped the lane's head but not yet linked its
+      // node.
+      if (metrics_) {
+        metrics_->contended();
+      }
+      do {
+        hardware_pause();
+        next = tail->next.load(std::memory_order_acquire);
+      } while (next == nullptr);
+    }
+    task = std::move(next->task);
+    l.tail.store(next, std::memory_order_relaxed);
+    release_node_(tail);
+    if (metrics_) {
+      metrics_->started();
+    }
+    return true;
   }
 
 } // namespace hep::concurrency
@@ -2,13 +2,22 @@
 #define hep_concurrency_SerialTaskQueue_h
 // vim: set sw=2 expandtab :
 
+#include "hep_concurrency/WaitingTaskList.h"
+#include "hep_concurrency/detail/serial_task.h"
+#include "hep_concurrency/serial_queue_metrics.h"
+#include "tbb/concurrent_vector.h"
 #include "tbb/task_group.h"
 
+#include <atomic>
+#include <chrono>
 #include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
 #include <functional>
 #include <memory>
-#include <mutex>
-#include <queue>
+#include <string>
 
 namespace hep::concurrency {
 
@@ -19,70 +28,234 @@ namespace hep::concurrency {
     concept convertible_to_task_t = std::convertible_to<F, task_t>;
   }
 
+  // Tasks of higher priority are started before waiting tasks of
+  // lower priority; tasks of equal priority are started in the order
+  // in which they were pushed.
+  enum class task_priority : unsigned char { low, normal, high };
+
+  // Opt-in execution of serial tasks without a round trip through the
+  // TBB scheduler:
+  //
+  // - A task that completes while further tasks are waiting executes
+  //   up to max_tasks of them itself, for as long as max_time has not
+  //   elapsed, before handing the next one to the task group.
+  //
+  // - If run_on_push is true, a task pushed from within a TBB task
+  //   onto an idle queue is executed by push(...) itself, which then
+  //   returns only after the task (and any tasks executed after it
+  //   as described above) has completed.  Tasks pushed by a task that
+  //   is itself being executed this way are not executed directly,
+  //   so that chains of serial resources do not grow the stack.
+  //
+  // Both keep a serial resource on one thread, with its data in that
+  // thread's cache, at the cost of delaying other work on that thread.
+  struct inline_execution {
+    unsigned int max_tasks{32u};
+    std::chrono::microseconds max_time{100};
+    bool run_on_push{true};
+  };
+
+  // The tasks are held in a multi-producer/single-consumer linked
+  // queue (D. Vyukov's design): push(...) appends a node with one
+  // atomic exchange, and only the thread that owns the "running" flag
+  // of the state word removes nodes.  The state word combines that
+  // flag (bit 0) with the pause count (remaining bits), so a thread
+  // can start the next task only if the queue is neither running nor
+  // paused, which it establishes with a single compare-and-swap.
+  //
+  // A thread that releases the running flag checks the queue again
+  // afterward, and a thread that appends a task checks the state word
+  // afterward.  As both sides use sequentially consistent operations,
+  // at least one of them observes the other, so no task is left
+  // behind without a thread to start it.
+  //
+  // Pushing a task does not allocate memory in the common case.  The
+  // task is stored in a detail::serial_task, which holds small
+  // callables in place, and the queue nodes are taken from a pool
+  // owned by the queue.  Nodes are returned to the pool when their
+  // tasks are started, and the pool grows only when more tasks are
+  // waiting than ever before; its memory is released when the queue
+  // is destroyed.
+  //
+  // Each task priority has its own linked queue ("lane"), and the
+  // owner of the running flag takes the next task from the
+  // highest-priority lane that is not empty.  With aging enabled, the
+  // oldest task of a lane is taken once it has been overtaken by
+  // max_overtakes tasks of higher priority.
   class SerialTaskQueue final {
   public:
-    SerialTaskQueue(tbb::task_group& group) : group_{&group} {}
+    class schedule_awaiter;
+
+    SerialTaskQueue(tbb::task_group& group);
+    SerialTaskQueue(tbb::task_group& group, inline_execution options);
 
     // Disable copy operations
     SerialTaskQueue(SerialTaskQueue const&) = delete;
     SerialTaskQueue& operator=(SerialTaskQueue const&) = delete;
 
-    template <detail::convertible_to_task_t F>
-    void push(F&& func);
+    // An exception thrown by a task pushed with push(...) is
+    // discarded.
+    template <detail::serial_task_callable F>
+    void push(F&& func, task_priority priority = task_priority::normal);
+
+    // As push(...), but returns a list to which the tasks that depend
+    // on the pushed task can be added.  They are spawned as soon as
+    // the pushed task completes, and receive the exception it threw,
+    // if any.
+    template <detail::serial_task_callable F>
+    [[nodiscard]] std::shared_ptr<WaitingTaskList> push_tracked(
+      F&& func,
+      task_priority priority = task_priority::normal);
+
+    // Returns an awaitable that resumes the awaiting coroutine as a
+    // task of this queue (see coroutine.h):
+    //
+    //   co_await queue.schedule();
+    schedule_awaiter schedule(
+      task_priority priority = task_priority::normal) noexcept;
 
     bool pause();
     bool resume();
 
-    // Used only by QueuedTask<T>::execute().
-    void notify_and_run();
+    // Thread-unsafe: to be called only before tasks are pushed.  A
+    // value of 0 disables aging.
+    void
+    enable_aging(unsigned int const max_overtakes) noexcept
+    {
+      max_overtakes_ = max_overtakes;
+    }
+
+    // Thread-unsafe: to be called only before tasks are pushed.  See
+    // serial_queue_metrics.h.
+    void enable_metrics(std::string name);
+    bool
+    metrics_enabled() const noexcept
+    {
+      return metrics_ != nullptr;
+    }
+    // Returns an empty snapshot if metrics are not enabled.
+    serial_queue_metrics metrics() const;
 
   private:
-    class QueuedTask;
-    using task_ptr_t = std::shared_ptr<QueuedTask>;
+    using clock = std::chrono::steady_clock;
+
+    struct queued_task {
+      detail::serial_task func{};
+      // Recorded only if metrics are enabled
+      clock::time_point pushed{};
+    };
+
+    struct node {
+      std::atomic<node*> next{nullptr};
+      queued_task task{};
+      std::uint32_t index{};
+      // Link in the pool's free list: 1 + the index of the next free
+      // node, or 0.
+      std::atomic<std::uint32_t> next_free{0u};
+    };
+
+    struct lane {
+      std::atomic<node*> head; // Most recently pushed node
+      std::atomic<node*> tail; // Node preceding the next task
+      // Number of times the oldest task has been overtaken; used only
+      // by the owner of the running flag.
+      unsigned int overtaken{};
+    };
+
+    static constexpr std::uint64_t running{1u};
+    static constexpr std::uint64_t one_pause{2u};
+    static constexpr std::size_t n_lanes{3u};
 
-    auto pickNextTask() -> task_ptr_t;
-    auto notify() -> task_ptr_t;
+    node* acquire_node_();
+    void release_node_(node* n) noexcept;
+    void enqueue_(detail::serial_task func, task_priority priority);
+    bool dequeue_(queued_task& task) noexcept;
+    bool dequeue_from_(lane& l, queued_task& task) noexcept;
+    bool empty_() const noexcept;
+    // Called by the running task upon completion; only the owner of
+    // the running flag may call it.
+    void notify_and_run_();
+    void start_if_ready_(bool from_push = false);
+    void run_(queued_task task);
+    void execute_(queued_task const& task);
+    void invoke_(queued_task const& task) noexcept;
 
     tbb::task_group* group_;
-    std::recursive_mutex mutex_{};
-    std::queue<task_ptr_t> taskQueue_{};
-    unsigned long pauseCount_{};
-    bool taskRunning_{false};
+    unsigned int max_inline_tasks_{};
+    clock::duration max_inline_time_{};
+    bool run_on_push_{false};
+    unsigned int max_overtakes_{};
+    std::unique_ptr<detail::serial_queue_recorder> metrics_{};
+    std::atomic<std::uint64_t> state_{0u};
+    // Node pool: the nodes never move, and are identified in the free
+    // list by their indices.  The free-list head holds a modification
+    // count in its upper 32 bits, so that a node that is taken and
+    // returned between the reading of the head and the
+    // compare-and-swap is not mistaken for an unchanged list.
+    tbb::concurrent_vector<node> nodes_{};
+    std::atomic<std::uint64_t> free_head_{0u};
+    lane lanes_[n_lanes]; // Indexed by task_priority
   };
 
-  class SerialTaskQueue::QueuedTask {
+  class SerialTaskQueue::schedule_awaiter {
   public:
-    QueuedTask(SerialTaskQueue* queue, task_t func)
-      : queue_{queue}, func_{std::move(func)}
-    {}
-
-    explicit operator bool() const { return static_cast<bool>(func_); }
-
+    bool
+    await_ready() const noexcept
+    {
+      return false;
+    }
     void
-    operator()() const
+    await_suspend(std::coroutine_handle<> const h) const
     {
-      try {
-        func_();
-      }
-      catch (...) {
-      }
-      queue_->notify_and_run();
+      queue_->push([h] { h.resume(); }, priority_);
     }
+    void
+    await_resume() const noexcept
+    {}
 
   private:
+    friend class SerialTaskQueue;
+    schedule_awaiter(SerialTaskQueue* queue, task_priority priority) noexcept
+      : queue_{queue}, priority_{priority}
+    {}
+
     SerialTaskQueue* queue_;
-    task_t func_;
+    task_priority priority_;
   };
 
-  template <detail::convertible_to_task_t F>
+  inline auto
+  SerialTaskQueue::schedule(task_priority const priority) noexcept
+    -> schedule_awaiter
+  {
+    return {this, priority};
+  }
+
+  template <detail::serial_task_callable F>
   void
-  SerialTaskQueue::push(F&& func)
+  SerialTaskQueue::push(F&& func, task_priority const priority)
   {
-    std::lock_guard sentry{mutex_};
-    taskQueue_.push(std::make_shared<QueuedTask>(this, std::forward<F>(func)));
-    if (auto next_task = pickNextTask()) {
-      group_->run(*next_task);
-    }
+    enqueue_(detail::serial_task{std::forward<F>(func)}, priority);
+    start_if_ready_(true);
+  }
+
+  template <detail::serial_task_callable F>
+  std::shared_ptr<WaitingTaskList>
+  SerialTaskQueue::push_tracked(F&& func, task_priority const priority)
+  {
+    auto done = std::make_shared<WaitingTaskList>(*group_);
+    push(
+      [f = std::forward<F>(func), done]() mutable {
+        std::exception_ptr ex_ptr;
+        try {
+          std::invoke(f);
+        }
+        catch (...) {
+          ex_ptr = std::current_exception();
+        }
+        done->doneWaiting(ex_ptr);
+      },
+      priority);
+    return done;
   }
 
 } // namespace hep::concurrency
@@ -26,7 +26,173 @@
 // they might be required again.  In that case, the
 // drop_unused_but_last(n) function can be called, where n is an
 // unsigned integer indicating the n "most recently created", yet
-// unused, entries that should be retained.
+// unused, entries that should be retained.  The amount of work done
+// by one call can be bounded by calling drop_unused_but_last(n, m),
+// which removes at most m (the oldest) of the remaining unused
+// entries.  The cleanup can also be performed in the background by a
+// cache_reaper (see cache_reaper.h), which is notified through the
+// function registered with set_insertion_hook(f) whenever an entry
+// is inserted.
+//
+// Watermark-based eviction
+// ------------------------
+//
+// If data are processed in increasing order of some quantity (e.g.
+// run or subrun number), a key whose range ends at or before the
+// current position (the "watermark") will never be matched again.
+// Keys that declare the (exclusive) upper bound of the values they
+// support:
+//
+//   struct range_of_values {
+//     ...
+//     unsigned upper_bound() const { return stop; }
+//   };
+//
+// can be kept in an index ordered by that bound.  The index is
+// maintained only once enable_watermark_index() has been called
+// (before the cache is used concurrently), so that caches that are
+// not watermark-driven do not pay for it.  Calling
+// advance_watermark(w) then removes every unused entry whose key's
+// upper bound is less than or equal to w.  Only the expired part of
+// the index is visited, so the cost is proportional to the number of
+// expired keys rather than the size of the cache.  Expired entries
+// that are still in use are retained and revisited the next time the
+// watermark is advanced.
+//
+// Compression of cold values
+// --------------------------
+//
+// Between being resident and being evicted, an unused entry may be
+// kept in compressed form.  After a codec has been provided (see
+// cache_codecs.h):
+//
+//   cache<iov, std::vector<float>> cache;
+//   cache.set_codec(run_length_codec<float>{});
+//
+// the cache records the time at which each entry was last accessed,
+// and calling compress_unused(idle_for) compresses every unused entry
+// that has not been accessed for at least the duration idle_for.
+// The value of a compressed entry is decompressed on demand the next
+// time a handle to it is taken, which requires exclusive access to
+// the entry.  Compressed entries are unused entries and therefore
+// remain subject to drop_unused(_but_last).
+//
+// Visiting the entries (see below) takes a handle to each entry and
+// so decompresses all of them.
+//
+// Replacing values
+// ----------------
+//
+// The emplace(key, value) function returns the existing entry if the
+// key is already present.  To update the value of an entry (e.g. when
+// a calibration is reloaded), call replace(key, value) instead:
+//
+//   auto old_h = cache.at(key);
+//   auto new_h = cache.replace(key, reloaded_calibration);
+//   // *old_h is the previous value, *new_h the reloaded one.
+//
+// The new value is published atomically: a lookup of the key returns
+// either the previous or the new version, never an invalid handle.
+// Each version has its own sequence number and reference count.
+// Handles to the previous version remain valid, and the previous
+// version is retained until the last of them is released.  Retained
+// versions are reclaimed by the next replace(...) of the key or the
+// next call to drop_unused(_but_last); the retained() function
+// returns the number not yet reclaimed.  An entry is not removed
+// while any of its versions is referenced.
+//
+// Value recycling
+// ---------------
+//
+// Entries holding large buffers (e.g. std::vector<float> calibration
+// tables) are frequently evicted only for an entry of the same size
+// to be created shortly afterward.  To avoid the allocator churn, the
+// cache can be configured to keep up to n evicted values in a pool:
+//
+//   cache<K, std::vector<float>> cache;
+//   cache.recycle_evicted_values(4);
+//
+// The pooled values can then be refilled by calling the emplace
+// overload that takes a function instead of a value:
+//
+//   cache.emplace(key, [](std::vector<float>& table) {
+//     table.assign(begin(pedestals), end(pedestals));
+//   });
+//
+// The function is invoked only if the key is not already present.
+// It receives either a recycled value, whose contents are whatever
+// was left by the previous owner, or a default-constructed value if
+// the pool is empty.
+//
+// Bulk loading
+// ------------
+//
+// When many entries are available at once (e.g. all IOVs of a
+// conditions payload), they can be inserted with a single
+// emplace_range(first, last) call.  A contiguous block of sequence
+// numbers is reserved for the whole range, so the n-th element of
+// the range receives the n-th sequence number of the block, and the
+// elements are inserted in parallel using tbb::parallel_for.  As
+// emplace_range may be called while the cache is in use, it cannot
+// resize the underlying maps itself (resizing is thread-unsafe).
+// Before the cache is used concurrently, reserve(n) may be called to
+// size them for n entries, avoiding rehashing during the load:
+//
+//   std::vector<std::pair<iov, calibration>> payload = ...;
+//   cache.reserve(std::size(payload));
+//   cache.emplace_range(cbegin(payload), cend(payload));
+//
+// Visiting live entries
+// ---------------------
+//
+// The entries of a cache may be visited while other threads use it:
+//
+//   cache.for_each([](Key const& key, Value const& value) {...});
+//   cache.parallel_for_each([](Key const& key, Value const& value) {...});
+//
+// Each entry is pinned by a handle for the duration of the call, so
+// it cannot be removed while it is being visited.  Entries inserted
+// or removed during the traversal may or may not be visited.  The
+// parallel version splits the traversal using tbb::parallel_for; the
+// range() member function returns the splittable range it uses, so
+// that users can drive the traversal themselves:
+//
+//   tbb::parallel_for(cache.range(), [](auto const& r) {
+//     r.for_each([](Key const& key, Value const& value) {...});
+//   });
+//
+// Recording accesses
+// ------------------
+//
+// A function registered with set_access_hook(f) is called with the
+// key of each entry found by at(...), entry_for(...), visit(...) or
+// visit_for(...), and of each entry returned by
+// emplace(...).  Lookups that find no entry, and the visits made by
+// for_each(...) and parallel_for_each(...), are not reported.  The
+// cache_access_recorder and cache_prefetcher (see cache_access_log.h)
+// use the hook to record the order in which a job accesses the
+// entries, and to load entries ahead of a later job that repeats it.
+// A cache has a single access hook; registering a second one throws
+// an exception rather than silently replacing the first.
+//
+// Per-thread front cache
+// ----------------------
+//
+// Conditions lookups tend to repeat the same keys many times on the
+// same thread.  Calling enable_front_cache(n) gives each thread that
+// calls at(...) or entry_for(...) a direct-mapped table of n recently
+// found entries.  A lookup that hits in this table does not acquire
+// any lock on the shared maps; it only increments the entry's
+// reference count.
+//
+// A front-cache slot is validated against an eviction epoch, which
+// is incremented whenever an entry is about to be erased.  The
+// lookup increments the reference count and then confirms the epoch
+// has not changed; the eraser increments the epoch and then confirms
+// the reference count is still zero.  Because both sides use
+// sequentially consistent operations, at least one of them observes
+// the other, so an entry is never erased out from under a handle
+// obtained through the front cache.
 //
 // Concurrent operations
 // ---------------------
@@ -74,6 +240,90 @@
 //      return true.  It is a runtime error for more than one key to
 //      support the same value.
 //
+// Borrowed access
+// ---------------
+//
+// For short, read-only uses of an entry, creating a handle (and
+// thereby modifying the entry's reference count) can be avoided:
+//
+//   float gain{};
+//   bool const found = cache.visit(key, [&gain](auto const&, auto const& c) {
+//     gain = c.gain;
+//   });
+//
+// The function is called with the key and value while a shared lock
+// on the entry is held, and visit returns whether the key was found.
+// The visit_for(t, f) function does the same for the entry whose key
+// supports t (see entry_for above).  The lock is released when the
+// function returns, so references to the key or value must not be
+// retained, and the function must not call other member functions of
+// the cache.
+//
+// Negative caching
+// ----------------
+//
+// A value for which no key is found requires a scan over all keys,
+// and the caller will typically then consult an external source
+// (e.g. a database) that may not have a payload either.  Calling
+// enable_negative_caching(n) lets the cache remember up to n such
+// values per value type:
+//
+//   - A failed entry_for(t) lookup is recorded, so that the next
+//     entry_for(t) call returns an invalid handle without scanning.
+//
+//   - Once the caller has established that no payload exists for t,
+//     it may call mark_absent(t).  Subsequent known_absent(t) calls
+//     then return true, allowing the caller to skip the external
+//     lookup:
+//
+//       if (auto h = cache.entry_for(t)) {
+//         return h;
+//       }
+//       if (cache.known_absent(t)) {
+//         return decltype(cache)::handle::invalid();
+//       }
+//       if (auto payload = query_database(t)) {
+//         return cache.emplace(payload->iov, std::move(payload->data));
+//       }
+//       cache.mark_absent(t);
+//
+// All remembered values are invalidated whenever an entry is inserted
+// into the cache, as the new key might support them.  The value type
+// must satisfy the same hashing and equality requirements as keys
+// (see below).
+//
+// Memory usage
+// ------------
+//
+// The memory_usage() function returns an estimate of the memory used
+// by the cache, broken down into:
+//
+//   - containers: the buckets and nodes of the underlying maps,
+//   - keys: the copies of each key held by the maps,
+//   - counters: the shared reference counts of the entries,
+//   - values: the (current, retained and compressed) values.
+//
+// The size of a key or value object itself is always accounted for.
+// Storage that it owns beyond that (e.g. the buffer of a std::vector)
+// is estimated by calling a function for each object, which may be
+// provided by the user:
+//
+//   auto const usage = cache.memory_usage([](calibration const& c) {
+//     return c.constants.capacity() * sizeof(float);
+//   });
+//
+// The default estimate is the capacity of contiguous containers such
+// as std::vector and std::string, and 0 for other types.  Values held
+// in the recycling pool are not included.
+//
+// For policies that evict entries across several caches (see
+// cache_registry.h), unused_entries(f) reports each unused entry with
+// its estimated size and the time it was last accessed, and
+// erase_if_unused(key) removes one of them.  Access times are
+// recorded only after track_access_times() has been called, or a
+// codec has been set (see above); otherwise they are reported as the
+// epoch of std::chrono::steady_clock.
+//
 // Hashing and equality
 // --------------------
 //
@@ -98,6 +348,15 @@
 //     bool operator==(range_of_values const& rov) const {...};
 //   };
 //
+// Dense key domains
+// -----------------
+//
+// For keys that map onto a small, dense range of indices, a
+// specialization of hep::concurrency::dense_key_traits allows the
+// dense_backend to be selected, an array-backed implementation of
+// the core cache interface that avoids hashing altogether.  See
+// detail/dense_cache.h for details.
+//
 // Technical notes
 // ---------------
 //
@@ -115,19 +374,37 @@
 
 #include "cetlib_except/exception.h"
 #include "hep_concurrency/assert_only_one_thread.h"
+#include "hep_concurrency/cache_backends.h"
+#include "hep_concurrency/cache_codecs.h"
 #include "hep_concurrency/cache_fwd.h"
 #include "hep_concurrency/cache_handle.h"
 #include "hep_concurrency/detail/cache_entry.h"
 #include "hep_concurrency/detail/cache_hashers.h"
+#include "hep_concurrency/detail/expiry_index.h"
+#include "hep_concurrency/detail/front_cache.h"
+#include "hep_concurrency/detail/negative_cache.h"
+#include "hep_concurrency/detail/value_pool.h"
 #include "tbb/concurrent_hash_map.h"
 #include "tbb/concurrent_unordered_map.h"
+#include "tbb/blocked_range.h"
+#include "tbb/enumerable_thread_specific.h"
+#include "tbb/parallel_for.h"
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <concepts>
+#include <cstddef>
 #include <functional>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <ranges>
+#include <span>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace hep::concurrency {
 
@@ -138,25 +415,75 @@ namespace hep::concurrency {
                                             key.supports(t)
                                             } -> std::convertible_to<bool>;
                                         };
+
+    template <typename Element, typename Key, typename Value>
+    concept key_value_pair =
+      requires(Element const& element) {
+        { element.first } -> std::convertible_to<Key const&>;
+        { element.second } -> std::convertible_to<Value const&>;
+      };
+
+    template <typename F, typename T>
+    concept size_estimator =
+      std::is_invocable_r_v<std::size_t, F const&, T const&>;
+
+    // Estimates the storage owned by an object beyond sizeof(T).
+    struct owned_storage {
+      template <typename T>
+      std::size_t
+      operator()(T const& t) const
+      {
+        if constexpr (std::ranges::contiguous_range<T> and
+                      requires { t.capacity(); }) {
+          return t.capacity() * sizeof(std::ranges::range_value_t<T>);
+        }
+        else {
+          return 0ull;
+        }
+      }
+    };
   }
 
-  template <detail::hashable_cache_key Key, typename Value>
+  struct cache_memory_usage {
+    std::size_t containers{};
+    std::size_t keys{};
+    std::size_t counters{};
+    std::size_t values{};
+
+    std::size_t
+    total() const noexcept
+    {
+      return containers + keys + counters + values;
+    }
+  };
+
+  // An entry that may be removed, as reported by
+  // cache::unused_entries(...)
+  template <typename Key>
+  struct cache_unused_entry {
+    Key key;
+    std::chrono::steady_clock::time_point last_access;
+    std::size_t bytes; // Key and (current or compressed) value
+  };
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
   class cache {
-    using count_map_t =
-      tbb::concurrent_unordered_map<Key,
-                                    detail::entry_count_ptr,
-                                    detail::counter_hasher<Key>>;
+    using count_map_t = typename Backend::
+      template index<Key, detail::entry_count_ptr, detail::counter_hasher<Key>>;
     using count_value_type = typename count_map_t::value_type;
-    using collection_t =
-      tbb::concurrent_hash_map<Key,
-                               detail::cache_entry<Value>,
-                               detail::collection_hasher<Key>>;
+    using sequenced_key_t = std::pair<std::size_t, Key>;
+    using count_range_t = typename count_map_t::const_range_type;
+    using collection_t = typename Backend::template map<
+      Key,
+      detail::cache_entry<Value>,
+      detail::collection_hasher<Key>>;
     using accessor = typename collection_t::accessor;
 
   public:
     using mapped_type = typename collection_t::mapped_type;
     using value_type = typename collection_t::value_type;
     using handle = cache_handle<Key, Value>;
+    class range_type;
 
     // Concurrent operations
     // ---------------------
@@ -181,13 +508,79 @@ namespace hep::concurrency {
       requires detail::key_with_support_function<Key, T>
     handle entry_for(handle hint, T const& t) const;
 
+    // See "Borrowed access" above.
+    template <std::invocable<Key const&, Value const&> F>
+    bool visit(Key const& key, F&& f) const;
+    template <typename T, std::invocable<Key const&, Value const&> F>
+      requires detail::key_with_support_function<Key, T>
+    bool visit_for(T const& t, F&& f) const;
+
+    // See "Negative caching" above.  Without negative caching
+    // enabled, mark_absent does nothing and known_absent returns
+    // false.
+    template <typename T>
+      requires detail::key_with_support_function<Key, T> and
+               detail::negative_cacheable<T>
+    void mark_absent(T const& t);
+    template <typename T>
+      requires detail::key_with_support_function<Key, T> and
+               detail::negative_cacheable<T>
+    bool known_absent(T const& t) const;
+
     template <typename T>
       requires std::convertible_to<T, Value>
     handle emplace(Key const& k, T&& value);
 
+    // The refill function is called with a recycled value (see
+    // recycle_evicted_values below) or, if none is available, a
+    // default-constructed one.
+    template <typename F>
+      requires(not std::convertible_to<F, Value>) and
+              std::invocable<F&, Value&> and std::default_initializable<Value>
+    handle emplace(Key const& k, F&& refill);
+
+    // Inserts each (key, value) pair of the range, copying the values.
+    // Keys already present in the cache are skipped, as are repeated
+    // keys within the range (only one of the pairs is inserted).
+    // Returns the number of inserted entries.
+    template <std::random_access_iterator It>
+      requires detail::key_value_pair<std::iter_value_t<It>, Key, Value>
+    std::size_t emplace_range(It first, It last);
+
+    // Publishes a new version of the entry for the key, inserting the
+    // entry if it is absent.  See "Replacing values" above.
+    template <typename T>
+      requires std::convertible_to<T, Value>
+    handle replace(Key const& k, T&& value);
+
+    // Visit each live entry, calling f(key, value)
+    template <std::invocable<Key const&, Value const&> F>
+    void for_each(F&& f) const;
+    template <std::invocable<Key const&, Value const&> F>
+    void parallel_for_each(F const& f) const;
+    range_type range() const;
+
     // Memory mitigations that remove unused cache entries
     void drop_unused();
     void drop_unused_but_last(std::size_t const keep_last);
+    // Removes at most max_dropped entries; returns the number removed.
+    std::size_t drop_unused_but_last(std::size_t keep_last,
+                                     std::size_t max_dropped);
+
+    // Removes unused entries whose keys cannot support the watermark
+    // or any value beyond it; returns the number of removed entries.
+    // Does nothing unless enable_watermark_index() has been called.
+    template <typename T>
+      requires detail::key_with_upper_bound<Key> and
+               std::totally_ordered_with<
+                 T,
+                 typename detail::expiry_index<Key>::bound_type>
+    std::size_t advance_watermark(T const& watermark);
+
+    // Compresses unused entries that have not been accessed for at
+    // least idle_for; returns the number of compressed entries.  Does
+    // nothing if no codec has been set.
+    std::size_t compress_unused(std::chrono::steady_clock::duration idle_for);
 
     // Thread-safe, but no synchronization
     // -----------------------------------
@@ -206,70 +599,671 @@ namespace hep::concurrency {
     {
       return std::size(counts_);
     }
+    size_t
+    recycled() const
+    {
+      return recycled_values_.size();
+    }
+    size_t
+    compressed() const
+    {
+      return n_compressed_;
+    }
+    size_t
+    retained() const
+    {
+      return n_retained_;
+    }
+
+    // See "Memory usage" above.
+    template <detail::size_estimator<Value> F = detail::owned_storage>
+    cache_memory_usage memory_usage(F const& value_storage = {}) const;
+    template <detail::size_estimator<Value> F = detail::owned_storage>
+    std::vector<cache_unused_entry<Key>> unused_entries(
+      F const& value_storage = {}) const;
+
+    // Removes the entry if it is unused; returns whether it was
+    // removed.
+    bool erase_if_unused(Key const& key);
+
+    // The keys of the entries drop_unused_but_last(keep_last) would
+    // remove, oldest first.  Erasing them one at a time with
+    // erase_if_unused(key) spreads that work over several calls.
+    std::vector<Key> unused_keys_but_last(std::size_t keep_last);
 
     // Thread-unsafe
     // -------------
     // Can be called only when serialized access to the cache is
     // guaranteed.
     void shrink_to_fit();
+    void reserve(std::size_t n);
+
+    // Retain up to max_pooled evicted values for reuse by the
+    // emplace(key, refill) overload.  A value of 0 (the default)
+    // disables recycling.
+    void
+    recycle_evicted_values(std::size_t const max_pooled)
+    {
+      recycled_values_.set_capacity(max_pooled);
+    }
+
+    // Give each thread a direct-mapped table of n_slots (rounded up
+    // to a power of 2) recently looked-up entries.
+    void
+    enable_front_cache(std::size_t const n_slots = 16)
+    {
+      front_caches_ = std::make_unique<front_caches_t>(front_cache_t{n_slots});
+    }
+
+    // Remember up to max_entries values per value type for which
+    // no key exists.  A value of 0 (the default) disables negative
+    // caching.
+    void
+    enable_negative_caching(std::size_t const max_entries = 1024)
+    {
+      negative_cache_.set_capacity(max_entries);
+    }
+
+    // Maintain the index used by advance_watermark(...) (see
+    // "Watermark-based eviction" above).
+    void
+    enable_watermark_index()
+      requires detail::key_with_upper_bound<Key>
+    {
+      if (expiry_index_.enabled()) {
+        return;
+      }
+      expiry_index_.enable();
+      for (auto const& pr : entries_) {
+        expiry_index_.insert(pr.first);
+      }
+    }
+
+    // Call hook() after each insertion of an entry.  The hook is
+    // called while the lock on the inserted entry is held; it must
+    // not access that entry.  Only one hook can be set: setting
+    // another throws an exception, and passing nullptr removes the
+    // hook, which only its owner may do.
+    void
+    set_insertion_hook(std::function<void()> hook)
+    {
+      set_hook_(insertion_hook_, std::move(hook), "insertion");
+    }
+
+    // Call hook(key) for each access to an entry (see "Recording
+    // accesses" above).  The hook may be called while a lock on the
+    // entry is held; it must not call member functions of the cache.
+    // As for set_insertion_hook, only one hook can be set.
+    void
+    set_access_hook(std::function<void(Key const&)> hook)
+    {
+      set_hook_(access_hook_, std::move(hook), "access");
+    }
+
+    // Record the time of each access (see "Memory usage" above).
+    void
+    track_access_times() noexcept
+    {
+      track_access_times_ = true;
+    }
+
+    // Use the codec to compress cold values (see "Compression of cold
+    // values" above).
+    template <detail::value_codec<Value> C>
+    void
+    set_codec(C codec)
+    {
+      codec_ = std::make_unique<codec_t const>(
+        [codec](Value const& value) { return codec.compress(value); },
+        [codec](std::span<std::byte const> bytes) -> Value {
+          return codec.decompress(bytes);
+        });
+    }
 
   private:
-    std::vector<std::pair<std::size_t, Key>>
+    using front_cache_t = detail::front_cache<Key, Value>;
+    using front_caches_t = tbb::enumerable_thread_specific<front_cache_t>;
+
+    struct codec_t {
+      std::function<std::vector<std::byte>(Value const&)> compress;
+      std::function<Value(std::span<std::byte const>)> decompress;
+    };
+
+    handle lookup_(Key const& key) const;
+    handle front_cache_lookup_(Key const& key) const;
+    template <typename T>
+    std::optional<Key> key_for_(T const& t) const;
+    bool find_resident_(accessor& access_token, Key const& key) const;
+    void decompress_(mapped_type& entry) const;
+    void touch_(detail::entry_count& count) const;
+
+    void install_(accessor& access_token,
+                  std::unique_ptr<Value> value,
+                  std::size_t sequence_number);
+    void publish_(accessor& access_token,
+                  std::unique_ptr<Value> value,
+                  std::size_t sequence_number);
+    std::size_t reclaim_retired_(mapped_type& entry);
+    void reclaim_all_retired_();
+    bool unreferenced_(accessor& access_token);
+    bool erase_(accessor& access_token);
+
+    template <typename F>
+    static void
+    set_hook_(F& current, F hook, char const* kind)
+    {
+      if (hook and current) {
+        throw cet::exception("Cache hook error.")
+          << "An " << kind << " hook is already set for this cache.\n";
+      }
+      current = std::move(hook);
+    }
+    void
+    accessed_(Key const& key) const
+    {
+      if (access_hook_) {
+        access_hook_(key);
+      }
+    }
+
+    std::vector<sequenced_key_t>
     unused_entries_()
     {
-      std::vector<std::pair<std::size_t, Key>> result;
+      std::vector<sequenced_key_t> result;
       for (auto const& [key, count] : counts_) {
-        if (count->use_count == 0u) {
+        if (count->use_count != 0u) {
+          continue;
+        }
+        // The index keeps the keys of erased entries.
+        typename collection_t::const_accessor access_token;
+        if (std::as_const(entries_).find(access_token, key)) {
           result.emplace_back(count->sequence_number, key);
         }
       }
       return result;
     }
+    std::vector<sequenced_key_t> oldest_unused_(std::size_t keep_last);
 
     std::atomic<std::size_t> next_sequence_number_{0ull};
-    collection_t entries_;
+    std::atomic<std::size_t> eviction_epoch_{0ull};
+    std::atomic<std::size_t> insertion_generation_{0ull};
+    mutable std::atomic<std::size_t> n_compressed_{0ull};
+    std::atomic<std::size_t> n_retained_{0ull};
+    // Mutable so that at(...) can decompress an entry; this requires
+    // an exclusive lock on the entry.
+    mutable collection_t entries_;
     count_map_t counts_;
+    detail::value_pool<Value> recycled_values_;
+    std::unique_ptr<front_caches_t> front_caches_{nullptr};
+    detail::expiry_index<Key> expiry_index_;
+    mutable detail::negative_cache negative_cache_;
+    std::unique_ptr<codec_t const> codec_{nullptr};
+    std::function<void()> insertion_hook_{};
+    std::function<void(Key const&)> access_hook_{};
+    bool track_access_times_{false};
+  };
+
+  // Splittable range (in the sense of tbb::parallel_for) over the
+  // entries of a cache.
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  class cache<Key, Value, Backend>::range_type {
+  public:
+    range_type(range_type& other, tbb::split)
+      : cache_{other.cache_}, keys_{other.keys_, tbb::split{}}
+    {}
+
+    bool
+    empty() const
+    {
+      return keys_.empty();
+    }
+    bool
+    is_divisible() const
+    {
+      return keys_.is_divisible();
+    }
+
+    template <std::invocable<Key const&, Value const&> F>
+    void
+    for_each(F&& f) const
+    {
+      for (auto const& [key, count] : keys_) {
+        if (auto h = cache_->lookup_(key)) {
+          f(h.key(), *h);
+        }
+      }
+    }
+
+  private:
+    friend class cache;
+    range_type(cache const& c, count_range_t keys)
+      : cache_{&c}, keys_{std::move(keys)}
+    {}
+
+    cache const* cache_;
+    count_range_t keys_;
   };
 
-  template <detail::hashable_cache_key Key, typename Value>
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
   template <typename T>
     requires std::convertible_to<T, Value>
   cache_handle<Key, Value>
-  cache<Key, Value>::emplace(Key const& key, T&& value)
+  cache<Key, Value, Backend>::emplace(Key const& key, T&& value)
   {
     // Lock held on key's map entry until the function returns.
     accessor access_token;
     if (not entries_.insert(access_token, key)) {
       // Entry already exists; return cached entry.
+      decompress_(access_token->second);
+      touch_(*access_token->second.count_);
+      accessed_(key);
       return handle{&access_token->first, &access_token->second};
     }
 
-    auto const sequence_number = next_sequence_number_.fetch_add(1);
+    install_(access_token,
+             std::make_unique<Value>(std::forward<T>(value)),
+             next_sequence_number_.fetch_add(1));
+    accessed_(key);
+    return handle{&access_token->first, &access_token->second};
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  template <typename F>
+    requires(not std::convertible_to<F, Value>) and
+            std::invocable<F&, Value&> and std::default_initializable<Value>
+  cache_handle<Key, Value>
+  cache<Key, Value, Backend>::emplace(Key const& key, F&& refill)
+  {
+    accessor access_token;
+    if (not entries_.insert(access_token, key)) {
+      decompress_(access_token->second);
+      touch_(*access_token->second.count_);
+      accessed_(key);
+      return handle{&access_token->first, &access_token->second};
+    }
+
+    auto value = recycled_values_.take();
+    try {
+      if (value == nullptr) {
+        value = std::make_unique<Value>();
+      }
+      refill(*value);
+    }
+    catch (...) {
+      // Do not leave an empty entry behind.
+      recycled_values_.give(value);
+      entries_.erase(access_token);
+      throw;
+    }
+    install_(
+      access_token, std::move(value), next_sequence_number_.fetch_add(1));
+    accessed_(key);
+    return handle{&access_token->first, &access_token->second};
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  template <std::random_access_iterator It>
+    requires detail::key_value_pair<std::iter_value_t<It>, Key, Value>
+  std::size_t
+  cache<Key, Value, Backend>::emplace_range(It const first, It const last)
+  {
+    auto const n = static_cast<std::size_t>(std::distance(first, last));
+    if (n == 0ull) {
+      return 0ull;
+    }
+
+    // Sequence numbers of skipped elements are simply not used.
+    auto const first_sequence_number = next_sequence_number_.fetch_add(n);
+    std::atomic<std::size_t> n_inserted{0ull};
+    tbb::parallel_for(
+      tbb::blocked_range<std::size_t>{0ull, n},
+      [this, first, first_sequence_number, &n_inserted](auto const& range) {
+        std::size_t local_inserted{};
+        for (auto i = range.begin(); i != range.end(); ++i) {
+          auto const& [key, value] = first[i];
+          accessor access_token;
+          if (not entries_.insert(access_token, key)) {
+            continue;
+          }
+          install_(access_token,
+                   std::make_unique<Value>(value),
+                   first_sequence_number + i);
+          ++local_inserted;
+        }
+        n_inserted += local_inserted;
+      });
+    return n_inserted;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  template <typename T>
+    requires std::convertible_to<T, Value>
+  cache_handle<Key, Value>
+  cache<Key, Value, Backend>::replace(Key const& key, T&& value)
+  {
+    // Construct the value before any lock is acquired.
+    auto new_value = std::make_unique<Value>(std::forward<T>(value));
+
+    accessor access_token;
+    if (entries_.insert(access_token, key)) {
+      install_(access_token,
+               std::move(new_value),
+               next_sequence_number_.fetch_add(1));
+      return handle{&access_token->first, &access_token->second};
+    }
+
+    auto& entry = access_token->second;
+    if (front_caches_) {
+      // Front-cache slots refer to the previous version.  See the
+      // "Per-thread front cache" notes for why the reference count is
+      // checked only after the epoch has been incremented.
+      ++eviction_epoch_;
+    }
+    if (entry.compressed_) {
+      entry.compressed_.reset();
+      --n_compressed_;
+    }
+    reclaim_retired_(entry);
+    if (entry.reference_count() != 0u) {
+      entry.retired_.emplace_back(std::move(entry.value_),
+                                  std::move(entry.count_));
+      ++n_retained_;
+    }
+    else {
+      recycled_values_.give(entry.value_);
+    }
+    publish_(
+      access_token, std::move(new_value), next_sequence_number_.fetch_add(1));
+    return handle{&access_token->first, &entry};
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  void
+  cache<Key, Value, Backend>::install_(accessor& access_token,
+                                       std::unique_ptr<Value> value,
+                                       std::size_t const sequence_number)
+  {
+    publish_(access_token, std::move(value), sequence_number);
+    expiry_index_.insert(access_token->first);
+    // Invalidate all recorded misses (see "Negative caching" above).
+    ++insertion_generation_;
+    if (insertion_hook_) {
+      insertion_hook_();
+    }
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  void
+  cache<Key, Value, Backend>::publish_(accessor& access_token,
+                                       std::unique_ptr<Value> value,
+                                       std::size_t const sequence_number)
+  {
     auto counter = detail::make_counter(sequence_number);
-    access_token->second = mapped_type{std::forward<T>(value), counter};
+    touch_(*counter);
+    auto& entry = access_token->second;
+    entry.value_ = std::move(value);
+    entry.count_ = counter;
 
-    auto [it, inserted] = counts_.insert(count_value_type{key, counter});
+    auto [it, inserted] =
+      counts_.insert(count_value_type{access_token->first, counter});
     if (not inserted) {
       it->second = counter;
     }
-    return handle{&access_token->first, &access_token->second};
   }
 
-  template <detail::hashable_cache_key Key, typename Value>
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  std::size_t
+  cache<Key, Value, Backend>::reclaim_retired_(mapped_type& entry)
+  {
+    // A retired version cannot gain references once its count has
+    // dropped to zero: it is no longer returned by any lookup, and
+    // the front-cache slots referring to it have been invalidated.
+    auto& retired = entry.retired_;
+    auto const unused = std::partition(
+      begin(retired), end(retired), [](auto const& version) {
+        return version.second->use_count != 0u;
+      });
+    for (auto it = unused; it != end(retired); ++it) {
+      recycled_values_.give(it->first);
+    }
+    n_retained_ -=
+      static_cast<std::size_t>(std::distance(unused, end(retired)));
+    retired.erase(unused, end(retired));
+    return std::size(retired);
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  void
+  cache<Key, Value, Backend>::reclaim_all_retired_()
+  {
+    if (n_retained_ == 0ull) {
+      return;
+    }
+    for (auto const& [key, count] : counts_) {
+      accessor access_token;
+      if (entries_.find(access_token, key)) {
+        reclaim_retired_(access_token->second);
+      }
+    }
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  bool
+  cache<Key, Value, Backend>::unreferenced_(accessor& access_token)
+  {
+    // It's possible the reference count to the element was increased
+    // after the caller decided to erase (or compress) it.  We
+    // therefore check that the reference count is actually zero
+    // before modifying the element.
+    if (access_token->second.reference_count() != 0u) {
+      return false;
+    }
+
+    if (front_caches_) {
+      // Invalidate all front-cache slots, and then check again for a
+      // reference taken through a front cache.
+      ++eviction_epoch_;
+      if (access_token->second.reference_count() != 0u) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  bool
+  cache<Key, Value, Backend>::erase_(accessor& access_token)
+  {
+    if (not unreferenced_(access_token)) {
+      return false;
+    }
+    // Keep the entry (and therefore its key) while any handle refers
+    // to a previous version.
+    if (reclaim_retired_(access_token->second) != 0ull) {
+      return false;
+    }
+
+    if (access_token->second.compressed_) {
+      --n_compressed_;
+    }
+    recycled_values_.give(access_token->second.value_);
+    expiry_index_.erase(access_token->first);
+    entries_.erase(access_token);
+    return true;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  bool
+  cache<Key, Value, Backend>::find_resident_(accessor& access_token,
+                                             Key const& key) const
+  {
+    // A shared lock suffices unless the value must be decompressed.
+    if (not std::as_const(entries_).find(access_token, key)) {
+      return false;
+    }
+    if (access_token->second.compressed_ == nullptr) {
+      return true;
+    }
+
+    access_token.release();
+    if (not entries_.find(access_token, key)) {
+      return false;
+    }
+    decompress_(access_token->second);
+    return true;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  void
+  cache<Key, Value, Backend>::decompress_(mapped_type& entry) const
+  {
+    // Another thread may have decompressed the value already.
+    if (entry.compressed_ == nullptr) {
+      return;
+    }
+    entry.value_ = std::make_unique<Value>(codec_->decompress(
+      std::span<std::byte const>{*entry.compressed_}));
+    entry.compressed_.reset();
+    --n_compressed_;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  void
+  cache<Key, Value, Backend>::touch_(detail::entry_count& count) const
+  {
+    if (codec_ or track_access_times_) {
+      count.last_access =
+        std::chrono::steady_clock::now().time_since_epoch().count();
+    }
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
   cache_handle<Key, Value>
-  cache<Key, Value>::at(Key const& key) const
+  cache<Key, Value, Backend>::at(Key const& key) const
   {
-    if (accessor access_token; entries_.find(access_token, key))
-      return handle{&access_token->first, &access_token->second};
-    return handle::invalid();
+    auto h = lookup_(key);
+    if (h) {
+      accessed_(key);
+    }
+    return h;
   }
 
-  template <detail::hashable_cache_key Key, typename Value>
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  cache_handle<Key, Value>
+  cache<Key, Value, Backend>::lookup_(Key const& key) const
+  {
+    if (not front_caches_) {
+      if (accessor access_token; find_resident_(access_token, key)) {
+        touch_(*access_token->second.count_);
+        return handle{&access_token->first, &access_token->second};
+      }
+      return handle::invalid();
+    }
+
+    if (auto h = front_cache_lookup_(key)) {
+      return h;
+    }
+
+    accessor access_token;
+    if (not find_resident_(access_token, key)) {
+      return handle::invalid();
+    }
+
+    // The element cannot be erased while the access token is held, so
+    // the epoch read here is not newer than the element.
+    auto& entry = access_token->second;
+    touch_(*entry.count_);
+    front_caches_->local().record(key,
+                                  &access_token->first,
+                                  entry.value_.get(),
+                                  entry.count_,
+                                  eviction_epoch_.load());
+    return handle{&access_token->first, &entry};
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  cache_handle<Key, Value>
+  cache<Key, Value, Backend>::front_cache_lookup_(Key const& key) const
+  {
+    auto* slot = front_caches_->local().find(key);
+    if (slot == nullptr) {
+      return handle::invalid();
+    }
+
+    auto const epoch = eviction_epoch_.load();
+    if (slot->epoch != epoch) {
+      return handle::invalid();
+    }
+
+    // See the "Per-thread front cache" notes above.  The counter is
+    // kept alive by the slot, so it may be incremented even if the
+    // entry has just been erased.
+    ++slot->counter->use_count;
+    if (eviction_epoch_.load() != epoch) {
+      --slot->counter->use_count;
+      return handle::invalid();
+    }
+    touch_(*slot->counter);
+    return handle{slot->key_address,
+                  slot->value,
+                  slot->counter.get(),
+                  handle::adopt_reference};
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
   template <typename T>
     requires detail::key_with_support_function<Key, T>
   cache_handle<Key, Value>
-  cache<Key, Value>::entry_for(T const& t) const
+  cache<Key, Value, Backend>::entry_for(T const& t) const
+  {
+    if (auto const key = key_for_(t)) {
+      return at(*key);
+    }
+    return handle::invalid();
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  template <std::invocable<Key const&, Value const&> F>
+  bool
+  cache<Key, Value, Backend>::visit(Key const& key, F&& f) const
+  {
+    accessor access_token;
+    if (not find_resident_(access_token, key)) {
+      return false;
+    }
+    auto const& entry = access_token->second;
+    touch_(*entry.count_);
+    std::invoke(std::forward<F>(f), access_token->first, *entry.value_);
+    accessed_(key);
+    return true;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  template <typename T, std::invocable<Key const&, Value const&> F>
+    requires detail::key_with_support_function<Key, T>
+  bool
+  cache<Key, Value, Backend>::visit_for(T const& t, F&& f) const
+  {
+    if (auto const key = key_for_(t)) {
+      return visit(*key, std::forward<F>(f));
+    }
+    return false;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  template <typename T>
+  std::optional<Key>
+  cache<Key, Value, Backend>::key_for_(T const& t) const
   {
+    // The generation must be read before the scan so that a key
+    // inserted during the scan invalidates a recorded miss.
+    [[maybe_unused]] auto const generation = insertion_generation_.load();
+    if constexpr (detail::negative_cacheable<T>) {
+      if (negative_cache_.enabled() and negative_cache_.find(t, generation)) {
+        return std::nullopt;
+      }
+    }
+
     std::vector<Key> matching_keys;
     for (auto const& [key, count] : counts_) {
       if (key.supports(t)) {
@@ -278,53 +1272,121 @@ namespace hep::concurrency {
     }
 
     if (std::empty(matching_keys)) {
-      return handle::invalid();
+      if constexpr (detail::negative_cacheable<T>) {
+        if (negative_cache_.enabled()) {
+          negative_cache_.insert(t, {generation, false});
+        }
+      }
+      return std::nullopt;
     }
 
     if (std::size(matching_keys) > 1) {
       throw cet::exception("Data retrieval error.")
         << "More than one key match.";
     }
-    return at(matching_keys[0]);
+    return std::move(matching_keys[0]);
   }
 
-  template <detail::hashable_cache_key Key, typename Value>
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
   template <typename T>
     requires detail::key_with_support_function<Key, T>
   cache_handle<Key, Value>
-  cache<Key, Value>::entry_for(handle const hint, T const& t) const
+  cache<Key, Value, Backend>::entry_for(handle const hint, T const& t) const
   {
     if (hint and hint.key().supports(t)) {
+      accessed_(hint.key());
       return hint;
     }
 
     return entry_for(t);
   }
 
-  template <detail::hashable_cache_key Key, typename Value>
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  template <std::invocable<Key const&, Value const&> F>
   void
-  cache<Key, Value>::drop_unused()
+  cache<Key, Value, Backend>::for_each(F&& f) const
   {
-    drop_unused_but_last(0);
+    range().for_each(std::forward<F>(f));
   }
 
-  template <detail::hashable_cache_key Key, typename Value>
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  template <std::invocable<Key const&, Value const&> F>
   void
-  cache<Key, Value>::drop_unused_but_last(std::size_t const keep_last)
+  cache<Key, Value, Backend>::parallel_for_each(F const& f) const
   {
-    auto entries_to_drop = unused_entries_();
-    // Sort in reverse-chronological order (according to sequence number).
-    std::sort(begin(entries_to_drop),
-              end(entries_to_drop),
-              [](auto const& a, auto const& b) { return a.first > b.first; });
+    tbb::parallel_for(range(), [&f](range_type const& r) { r.for_each(f); });
+  }
 
-    if (std::size(entries_to_drop) <= keep_last) {
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  auto
+  cache<Key, Value, Backend>::range() const -> range_type
+  {
+    // Iterating over counts_ is safe during concurrent insertion, and
+    // counts_ does not shrink except during shrink_to_fit().
+    return range_type{*this, counts_.range()};
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  template <typename T>
+    requires detail::key_with_support_function<Key, T> and
+             detail::negative_cacheable<T>
+  void
+  cache<Key, Value, Backend>::mark_absent(T const& t)
+  {
+    if (not negative_cache_.enabled()) {
       return;
     }
+    auto const generation = insertion_generation_.load();
+    negative_cache_.insert(t, {generation, true});
+  }
 
-    auto const erase_begin = cbegin(entries_to_drop) + keep_last;
-    auto const erase_end = cend(entries_to_drop);
-    for (auto it = erase_begin; it != erase_end; ++it) {
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  template <typename T>
+    requires detail::key_with_support_function<Key, T> and
+             detail::negative_cacheable<T>
+  bool
+  cache<Key, Value, Backend>::known_absent(T const& t) const
+  {
+    if (not negative_cache_.enabled()) {
+      return false;
+    }
+    auto const miss = negative_cache_.find(t, insertion_generation_.load());
+    return miss and miss->confirmed;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  void
+  cache<Key, Value, Backend>::drop_unused()
+  {
+    drop_unused_but_last(0);
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  void
+  cache<Key, Value, Backend>::drop_unused_but_last(std::size_t const keep_last)
+  {
+    drop_unused_but_last(keep_last, std::numeric_limits<std::size_t>::max());
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  std::size_t
+  cache<Key, Value, Backend>::drop_unused_but_last(
+    std::size_t const keep_last,
+    std::size_t const max_dropped)
+  {
+    reclaim_all_retired_();
+    auto entries_to_drop = oldest_unused_(keep_last);
+    if (max_dropped < std::size(entries_to_drop)) {
+      // Keys of entries erased earlier may still be listed, so the
+      // candidates are visited from the oldest until enough entries
+      // have been dropped.
+      std::ranges::sort(entries_to_drop, {}, &sequenced_key_t::first);
+    }
+
+    std::size_t n_dropped{};
+    for (auto it = begin(entries_to_drop);
+         it != end(entries_to_drop) and n_dropped != max_dropped;
+         ++it) {
       // We need to protect access to the element that is about to
       // be erased (via entries_.find(...))--if we don't, then the
       // reference count can be incremented during an insert and we
@@ -334,36 +1396,248 @@ namespace hep::concurrency {
         continue;
       }
 
-      // It's possible the reference count to the element was
-      // increased between the unused_entries_() call and the
-      // entries_.find(...) call made directly above.  We therefore
-      // check that the reference count is actually zero before
-      // erasing the element.
-      if (access_token->second.reference_count() != 0u) {
+      if (erase_(access_token)) {
+        ++n_dropped;
+      }
+    }
+    return n_dropped;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  auto
+  cache<Key, Value, Backend>::oldest_unused_(std::size_t const keep_last)
+    -> std::vector<sequenced_key_t>
+  {
+    auto result = unused_entries_();
+    if (std::size(result) <= keep_last) {
+      return {};
+    }
+
+    // Move the oldest entries (according to sequence number) to the
+    // front; the most recent keep_last entries are never among them.
+    auto const erase_end = end(result) - keep_last;
+    std::ranges::nth_element(
+      begin(result), erase_end, end(result), {}, &sequenced_key_t::first);
+    result.erase(erase_end, end(result));
+    return result;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  template <typename T>
+    requires detail::key_with_upper_bound<Key> and
+             std::totally_ordered_with<
+               T,
+               typename detail::expiry_index<Key>::bound_type>
+  std::size_t
+  cache<Key, Value, Backend>::advance_watermark(T const& watermark)
+  {
+    std::size_t n_removed{};
+    // Entries that are still in use stay in the index; erase_ drops
+    // the others from it.
+    expiry_index_.expire(watermark, [this, &n_removed](Key const& key) {
+      accessor access_token;
+      if (entries_.find(access_token, key) and erase_(access_token)) {
+        ++n_removed;
+      }
+    });
+    return n_removed;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  template <detail::size_estimator<Value> F>
+  cache_memory_usage
+  cache<Key, Value, Backend>::memory_usage(F const& value_storage) const
+  {
+    // The layouts of the maps are given by the backend (see
+    // cache_backends.h).  A counter shares one allocation with its
+    // control block (two reference counts and a virtual table
+    // pointer).
+    constexpr auto counter_bytes =
+      sizeof(detail::entry_count) + 2 * sizeof(int) + sizeof(void*);
+    detail::owned_storage const key_storage;
+
+    // Iterating over counts_ is safe during concurrent use (see
+    // range()); the entries are inspected under a shared lock.
+    cache_memory_usage result;
+    result.containers =
+      entries_.bucket_count() * Backend::map_bucket_bytes +
+      counts_.unsafe_bucket_count() * Backend::index_bucket_bytes;
+    for (auto const& [key, count] : counts_) {
+      auto const key_bytes = sizeof(Key) + key_storage(key);
+      result.containers +=
+        Backend::index_node_bytes + sizeof(detail::entry_count_ptr);
+      result.keys += key_bytes;
+      result.counters += counter_bytes;
+
+      typename collection_t::const_accessor access_token;
+      if (not entries_.find(access_token, key)) {
         continue;
       }
+      auto const& entry = access_token->second;
+      result.containers += Backend::map_node_bytes + sizeof(mapped_type);
+      result.keys += key_bytes;
+      if (entry.value_) {
+        result.values += sizeof(Value) + value_storage(*entry.value_);
+      }
+      if (entry.compressed_) {
+        result.values += sizeof(std::vector<std::byte>) +
+                         entry.compressed_->capacity();
+      }
+      for (auto const& [value, counter] : entry.retired_) {
+        result.values += sizeof(Value) + value_storage(*value);
+        result.counters += counter_bytes;
+      }
+      using retired_version = typename decltype(entry.retired_)::value_type;
+      result.containers +=
+        entry.retired_.capacity() * sizeof(retired_version);
+    }
+    return result;
+  }
 
-      entries_.erase(access_token);
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  template <detail::size_estimator<Value> F>
+  std::vector<cache_unused_entry<Key>>
+  cache<Key, Value, Backend>::unused_entries(F const& value_storage) const
+  {
+    detail::owned_storage const key_storage;
+    std::vector<cache_unused_entry<Key>> result;
+    for (auto const& [key, count] : counts_) {
+      if (count->use_count != 0u) {
+        continue;
+      }
+      typename collection_t::const_accessor access_token;
+      if (not entries_.find(access_token, key)) {
+        continue;
+      }
+      auto const& entry = access_token->second;
+      auto bytes = sizeof(Key) + key_storage(key);
+      if (entry.value_) {
+        bytes += sizeof(Value) + value_storage(*entry.value_);
+      }
+      if (entry.compressed_) {
+        bytes += entry.compressed_->capacity();
+      }
+      using clock = std::chrono::steady_clock;
+      result.push_back(
+        {key,
+         clock::time_point{clock::duration{entry.count_->last_access}},
+         bytes});
+    }
+    return result;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  bool
+  cache<Key, Value, Backend>::erase_if_unused(Key const& key)
+  {
+    accessor access_token;
+    if (not entries_.find(access_token, key)) {
+      return false;
+    }
+    return erase_(access_token);
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  std::vector<Key>
+  cache<Key, Value, Backend>::unused_keys_but_last(std::size_t const keep_last)
+  {
+    auto candidates = oldest_unused_(keep_last);
+    std::ranges::sort(candidates, {}, &sequenced_key_t::first);
+    std::vector<Key> result;
+    result.reserve(std::size(candidates));
+    for (auto& [sequence_number, key] : candidates) {
+      result.push_back(std::move(key));
     }
+    return result;
   }
 
-  template <detail::hashable_cache_key Key, typename Value>
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  std::size_t
+  cache<Key, Value, Backend>::compress_unused(
+    std::chrono::steady_clock::duration const idle_for)
+  {
+    if (not codec_) {
+      return 0ull;
+    }
+
+    auto const cutoff =
+      (std::chrono::steady_clock::now() - idle_for).time_since_epoch().count();
+    std::vector<Key> cold_keys;
+    for (auto const& [key, count] : counts_) {
+      if (count->use_count == 0u and count->last_access <= cutoff) {
+        cold_keys.push_back(key);
+      }
+    }
+
+    std::size_t n_compressed{};
+    for (auto const& key : cold_keys) {
+      accessor access_token;
+      if (not entries_.find(access_token, key)) {
+        continue;
+      }
+      auto& entry = access_token->second;
+      // The entry may have been accessed since it was collected above.
+      if (entry.compressed_ or entry.count_->last_access > cutoff or
+          not unreferenced_(access_token)) {
+        continue;
+      }
+      entry.compressed_ = std::make_unique<std::vector<std::byte> const>(
+        codec_->compress(*entry.value_));
+      if (not recycled_values_.give(entry.value_)) {
+        entry.value_.reset();
+      }
+      ++n_compressed;
+    }
+    n_compressed_ += n_compressed;
+    return n_compressed;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
   void
-  cache<Key, Value>::shrink_to_fit()
+  cache<Key, Value, Backend>::shrink_to_fit()
   {
     HEP_CONCURRENCY_ASSERT_ONLY_ONE_THREAD();
     drop_unused();
+    // Also removes any tombstones left by the backend.
+    entries_.rehash();
     std::vector<count_value_type> used_keys;
-    std::transform(begin(entries_),
-                   end(entries_),
+    std::transform(entries_.begin(),
+                   entries_.end(),
                    back_inserter(used_keys),
                    [](auto const& pr) {
                      return count_value_type{pr.first, pr.second.count_};
                    });
     counts_ = count_map_t(begin(used_keys), end(used_keys));
+    recycled_values_.clear();
+    negative_cache_.clear();
+    expiry_index_.clear();
+    for (auto const& [key, count] : used_keys) {
+      expiry_index_.insert(key);
+    }
+    if (front_caches_) {
+      ++eviction_epoch_;
+      front_caches_->clear();
+    }
+  }
+
+  template <detail::hashable_cache_key Key, typename Value, typename Backend>
+  void
+  cache<Key, Value, Backend>::reserve(std::size_t const n)
+  {
+    HEP_CONCURRENCY_ASSERT_ONLY_ONE_THREAD();
+    entries_.rehash(n);
+    // tbb::concurrent_unordered_map::reserve(n) does not return for
+    // n <= 32 (oneTBB 2021.8); the index needs no reservation for so
+    // few entries anyway.
+    if (n > 32ull) {
+      counts_.reserve(n);
+    }
   }
 }
 
+// The array-backed implementation for dense key domains.
+#include "hep_concurrency/detail/dense_cache.h"
+
 #endif /* hep_concurrency_cache_h */
 
 // Local Variables:
@@ -0,0 +1,479 @@
+#ifndef hep_concurrency_cache_access_log_h
+#define hep_concurrency_cache_access_log_h
+
+// ====================================================================
+// Successive jobs of a processing campaign tend to access the entries
+// of a cache (e.g. conditions payloads) in nearly the same order.
+// The facilities below record that order in one job and replay it as
+// a prefetch schedule in a later one.
+//
+// Recording:
+//
+//   cache<iov, calibration> calibrations;
+//   cache_access_recorder recorder{calibrations};
+//   ... // Process the job
+//   recorder.write("calibrations.hcal");
+//
+// Replaying:
+//
+//   tbb::task_group group;
+//   cache<iov, calibration> calibrations;
+//   auto const log = read_cache_access_log<iov>("calibrations.hcal");
+//   cache_prefetcher prefetcher{calibrations, group, log,
+//                               [](iov const& key) { return load(key); }};
+//   ... // Process the job
+//   group.wait();
+//
+// Both attach to the cache through its access hook (see "Recording
+// accesses" in cache.h).  As a cache has only one access hook, a
+// recorder and a prefetcher cannot be attached to the same cache at
+// the same time: constructing the second throws an exception, and the
+// hook of the first is left in place.  Each must be destroyed before
+// the cache, and only once the cache is no longer accessed
+// concurrently.  The destructor of a prefetcher calls group.wait(),
+// which runs any prefetch task not yet started on the calling thread;
+// the prefetcher must therefore not be destroyed from within a task
+// of the group, and the user should call group.wait() beforehand (as
+// above) to receive any exception thrown by the other tasks of the
+// group.
+//
+// The log holds one record per access, in the order of the accesses,
+// with the time elapsed since the recorder was created.  Threads
+// record into separate buffers, so recording does not contend on a
+// shared structure; the buffers are merged by time when the log is
+// requested.  In the file, each record occupies the bytes of its key
+// plus a variable-length time difference to the preceding record;
+// keys must therefore be trivially copyable.
+//
+// The prefetcher does not use the recorded times, as the speed of a
+// job depends on the machine it runs on.  Instead, it reduces the
+// log to the sequence of first accesses to each key, and tracks the
+// progress of the job through that sequence: whenever an entry is
+// accessed, the values for the next 'lookahead' keys of the sequence
+// are loaded by tasks run on the user's tbb::task_group, unless they
+// are already present.  A key that is evicted and later accessed
+// again is not prefetched a second time.  Prefetching is a best
+// effort: a load that throws is counted and otherwise ignored, so
+// that the job's own lookup of the key reports the error.
+// ====================================================================
+
+#include "cetlib_except/exception.h"
+#include "hep_concurrency/cache.h"
+#include "hep_concurrency/detail/cache_hashers.h"
+#include "tbb/enumerable_thread_specific.h"
+#include "tbb/task_group.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace hep::concurrency {
+
+  template <typename Key>
+  struct cache_access {
+    std::size_t sequence; // Position of the access within the log
+    std::chrono::nanoseconds time; // Since the start of the recording
+    Key key;
+  };
+
+  template <typename Key>
+  using cache_access_log = std::vector<cache_access<Key>>;
+
+  template <typename Key>
+    requires std::is_trivially_copyable_v<Key>
+  void write_cache_access_log(std::string const& filename,
+                              cache_access_log<Key> const& log);
+
+  template <typename Key>
+    requires std::is_trivially_copyable_v<Key>
+  cache_access_log<Key> read_cache_access_log(std::string const& filename);
+
+  // ------------------------------------------------------------------
+
+  template <typename Key, typename Value, typename Backend = tbb_backend>
+  class cache_access_recorder {
+  public:
+    explicit cache_access_recorder(cache<Key, Value, Backend>& c);
+    ~cache_access_recorder();
+
+    // Disable copy operations
+    cache_access_recorder(cache_access_recorder const&) = delete;
+    cache_access_recorder& operator=(cache_access_recorder const&) = delete;
+
+    // Thread-unsafe: to be called only when the cache is not accessed
+    // concurrently.
+    cache_access_log<Key> log() const;
+    void
+    write(std::string const& filename) const
+      requires std::is_trivially_copyable_v<Key>
+    {
+      write_cache_access_log(filename, log());
+    }
+
+  private:
+    struct record {
+      std::chrono::steady_clock::duration time;
+      Key key;
+    };
+
+    cache<Key, Value, Backend>& cache_;
+    std::chrono::steady_clock::time_point const start_;
+    tbb::enumerable_thread_specific<std::vector<record>> records_;
+  };
+
+  // ------------------------------------------------------------------
+
+  struct prefetch_options {
+    // Number of keys, beyond the last one accessed, whose values are
+    // loaded ahead of time.
+    std::size_t lookahead{16ull};
+  };
+
+  template <typename Key, typename Value, typename Backend = tbb_backend>
+  class cache_prefetcher {
+  public:
+    using loader = std::function<Value(Key const&)>;
+
+    cache_prefetcher(cache<Key, Value, Backend>& c,
+                     tbb::task_group& group,
+                     cache_access_log<Key> const& log,
+                     std::type_identity_t<loader> load,
+                     prefetch_options const& options = {});
+    ~cache_prefetcher();
+
+    // Disable copy operations
+    cache_prefetcher(cache_prefetcher const&) = delete;
+    cache_prefetcher& operator=(cache_prefetcher const&) = delete;
+
+    // Number of keys of the schedule reached by the job
+    std::size_t
+    position() const noexcept
+    {
+      return position_;
+    }
+    // Number of values loaded, and of loads that threw
+    std::size_t
+    loaded() const noexcept
+    {
+      return loaded_;
+    }
+    std::size_t
+    failed() const noexcept
+    {
+      return failed_;
+    }
+
+  private:
+    using positions_t = std::unordered_map<Key,
+                                           std::size_t,
+                                           detail::counter_hasher<Key>,
+                                           std::equal_to<>>;
+
+    void advance_(Key const& key);
+    void schedule_through_(std::size_t end);
+    void prefetch_(std::size_t i);
+
+    cache<Key, Value, Backend>& cache_;
+    tbb::task_group& group_;
+    std::vector<Key> schedule_{};
+    positions_t positions_{};
+    loader load_;
+    std::size_t const lookahead_;
+    std::atomic<std::size_t> position_{0ull};
+    std::atomic<std::size_t> scheduled_{0ull};
+    std::atomic<std::size_t> loaded_{0ull};
+    std::atomic<std::size_t> failed_{0ull};
+  };
+
+  // ----------------------------------------------------------------------------
+  // Implementation below
+
+  namespace detail {
+    // Set while a prefetch task accesses the cache, so that its own
+    // accesses do not count as progress of the job.
+    inline thread_local bool prefetching{false};
+
+    inline constexpr std::array<char, 4> access_log_magic{'H', 'C', 'A', 'L'};
+    inline constexpr std::uint32_t access_log_version{1u};
+
+    [[noreturn]] inline void
+    throw_access_log_error(std::string const& filename, char const* what)
+    {
+      throw cet::exception("Cache access log error.")
+        << "File '" << filename << "': " << what << '\n';
+    }
+
+    // Unsigned LEB128 encoding
+    inline void
+    write_varint(std::ostream& os, std::uint64_t n)
+    {
+      do {
+        auto byte = static_cast<unsigned char>(n & 0x7fu);
+        n >>= 7;
+        if (n != 0u) {
+          byte |= 0x80u;
+        }
+        os.put(static_cast<char>(byte));
+      } while (n != 0u);
+    }
+
+    inline bool
+    read_varint(std::istream& is, std::uint64_t& n)
+    {
+      n = 0u;
+      for (unsigned shift{}; shift < 64u; shift += 7u) {
+        char c;
+        if (not is.get(c)) {
+          return false;
+        }
+        auto const byte = static_cast<unsigned char>(c);
+        n |= static_cast<std::uint64_t>(byte & 0x7fu) << shift;
+        if ((byte & 0x80u) == 0u) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    template <typename T>
+    void
+    write_raw(std::ostream& os, T const& t)
+    {
+      auto const bytes = std::bit_cast<std::array<char, sizeof(T)>>(t);
+      os.write(bytes.data(), sizeof(T));
+    }
+
+    template <typename T>
+    bool
+    read_raw(std::istream& is, T& t)
+    {
+      std::array<char, sizeof(T)> bytes;
+      if (not is.read(bytes.data(), sizeof(T))) {
+        return false;
+      }
+      t = std::bit_cast<T>(bytes);
+      return true;
+    }
+  }
+
+  template <typename Key>
+    requires std::is_trivially_copyable_v<Key>
+  void
+  write_cache_access_log(std::string const& filename,
+                         cache_access_log<Key> const& log)
+  {
+    std::ofstream os{filename, std::ios::binary};
+    if (not os) {
+      detail::throw_access_log_error(filename, "cannot be opened for writing");
+    }
+    os.write(detail::access_log_magic.data(),
+             std::size(detail::access_log_magic));
+    detail::write_raw(os, detail::access_log_version);
+    detail::write_raw(os, static_cast<std::uint32_t>(sizeof(Key)));
+    detail::write_raw(os, static_cast<std::uint64_t>(std::size(log)));
+
+    std::chrono::nanoseconds previous{};
+    for (auto const& access : log) {
+      // The log is ordered by time, so the differences are
+      // non-negative.
+      detail::write_varint(
+        os, static_cast<std::uint64_t>((access.time - previous).count()));
+      detail::write_raw(os, access.key);
+      previous = access.time;
+    }
+    if (not os.flush()) {
+      detail::throw_access_log_error(filename, "write failed");
+    }
+  }
+
+  template <typename Key>
+    requires std::is_trivially_copyable_v<Key>
+  cache_access_log<Key>
+  read_cache_access_log(std::string const& filename)
+  {
+    std::ifstream is{filename, std::ios::binary};
+    if (not is) {
+      detail::throw_access_log_error(filename, "cannot be opened for reading");
+    }
+    std::array<char, 4> magic;
+    std::uint32_t version;
+    std::uint32_t key_size;
+    std::uint64_t n_records;
+    if (not is.read(magic.data(), std::size(magic)) or
+        magic != detail::access_log_magic or
+        not detail::read_raw(is, version) or
+        version != detail::access_log_version) {
+      detail::throw_access_log_error(filename, "not a cache access log");
+    }
+    if (not detail::read_raw(is, key_size) or key_size != sizeof(Key) or
+        not detail::read_raw(is, n_records)) {
+      detail::throw_access_log_error(filename,
+                                     "key size does not match the key type");
+    }
+
+    cache_access_log<Key> result;
+    std::chrono::nanoseconds time{};
+    for (std::uint64_t i{}; i != n_records; ++i) {
+      std::uint64_t delta;
+      cache_access<Key> access{i, {}, {}};
+      if (not detail::read_varint(is, delta) or
+          not detail::read_raw(is, access.key)) {
+        detail::throw_access_log_error(filename, "truncated record");
+      }
+      time += std::chrono::nanoseconds(delta);
+      access.time = time;
+      result.push_back(std::move(access));
+    }
+    return result;
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  cache_access_recorder<Key, Value, Backend>::cache_access_recorder(
+    cache<Key, Value, Backend>& c)
+    : cache_{c}, start_{std::chrono::steady_clock::now()}
+  {
+    cache_.set_access_hook([this](Key const& key) {
+      records_.local().push_back(
+        {std::chrono::steady_clock::now() - start_, key});
+    });
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  cache_access_recorder<Key, Value, Backend>::~cache_access_recorder()
+  {
+    cache_.set_access_hook(nullptr);
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  cache_access_log<Key>
+  cache_access_recorder<Key, Value, Backend>::log() const
+  {
+    std::vector<record const*> merged;
+    for (auto const& records : records_) {
+      for (auto const& r : records) {
+        merged.push_back(&r);
+      }
+    }
+    // Each thread's records are already in order of time.
+    std::stable_sort(begin(merged), end(merged), [](auto a, auto b) {
+      return a->time < b->time;
+    });
+
+    cache_access_log<Key> result;
+    result.reserve(std::size(merged));
+    for (auto const* r : merged) {
+      result.push_back(
+        {std::size(result),
+         std::chrono::duration_cast<std::chrono::nanoseconds>(r->time),
+         r->key});
+    }
+    return result;
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  cache_prefetcher<Key, Value, Backend>::cache_prefetcher(
+    cache<Key, Value, Backend>& c,
+    tbb::task_group& group,
+    cache_access_log<Key> const& log,
+    std::type_identity_t<loader> load,
+    prefetch_options const& options)
+    : cache_{c}
+    , group_{group}
+    , load_{std::move(load)}
+    , lookahead_{options.lookahead}
+  {
+    for (auto const& access : log) {
+      if (positions_.try_emplace(access.key, std::size(schedule_)).second) {
+        schedule_.push_back(access.key);
+      }
+    }
+    // The hook must be set before any prefetch task accesses the
+    // cache.
+    cache_.set_access_hook([this](Key const& key) { advance_(key); });
+    schedule_through_(lookahead_);
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  cache_prefetcher<Key, Value, Backend>::~cache_prefetcher()
+  {
+    // The prefetch tasks access the cache, and thereby the hook.
+    try {
+      group_.wait();
+    }
+    catch (...) {
+      // Thrown by a task other than a prefetch task; a destructor
+      // cannot propagate it (see the notes at the top of this file).
+    }
+    cache_.set_access_hook(nullptr);
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  void
+  cache_prefetcher<Key, Value, Backend>::advance_(Key const& key)
+  {
+    if (detail::prefetching) {
+      return;
+    }
+    auto const it = positions_.find(key);
+    if (it == cend(positions_)) {
+      return;
+    }
+    auto const reached = it->second + 1;
+    auto position = position_.load();
+    while (position < reached and
+           not position_.compare_exchange_weak(position, reached)) {}
+    schedule_through_(std::max(position, reached) + lookahead_);
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  void
+  cache_prefetcher<Key, Value, Backend>::schedule_through_(std::size_t end)
+  {
+    end = std::min(end, std::size(schedule_));
+    auto first = scheduled_.load();
+    do {
+      if (first >= end) {
+        return;
+      }
+    } while (not scheduled_.compare_exchange_weak(first, end));
+
+    // This thread has claimed the keys [first, end).
+    for (auto i = first; i != end; ++i) {
+      group_.run([this, i] { prefetch_(i); });
+    }
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  void
+  cache_prefetcher<Key, Value, Backend>::prefetch_(std::size_t const i)
+  {
+    detail::prefetching = true;
+    try {
+      auto const& key = schedule_[i];
+      if (not cache_.visit(key, [](Key const&, Value const&) {})) {
+        cache_.emplace(key, load_(key));
+        ++loaded_;
+      }
+    }
+    catch (...) {
+      ++failed_;
+    }
+    detail::prefetching = false;
+  }
+}
+
+#endif /* hep_concurrency_cache_access_log_h */
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,99 @@
+#ifndef hep_concurrency_cache_backends_h
+#define hep_concurrency_cache_backends_h
+
+// ====================================================================
+// Storage backends for the cache class template
+//
+// The third template parameter of cache selects the concurrent maps
+// in which the entries are stored:
+//
+//   cache<K, V> c1;                                // tbb_backend
+//   cache<K, V, open_addressing_backend<4096>> c2; // see below
+//
+// A backend provides two member alias templates and the approximate
+// layout of the maps they select:
+//
+//   map<Key, T, HashCompare> -- the primary map, which must provide
+//       the accessor interface of tbb::concurrent_hash_map (find,
+//       insert and erase with (const_)accessor objects, size, empty,
+//       bucket_count, rehash, and thread-unsafe iteration).  The
+//       addresses of elements must remain stable until the elements
+//       are erased.
+//
+//   index<Key, T, Hasher> -- the auxiliary map of keys to reference
+//       counts, which must provide the interface of
+//       tbb::concurrent_unordered_map (safe iteration and splittable
+//       ranges during concurrent insertion).
+//
+//   map_bucket_bytes, map_node_bytes, index_bucket_bytes and
+//   index_node_bytes -- the bytes used by each bucket of a map, and
+//       by each of its elements besides the element itself, used by
+//       cache::memory_usage() (and hence by cache_registry budgets).
+//
+// The open_addressing_backend is intended for read-dominated
+// workloads: a lookup locks only the slot holding the key, rather
+// than a bucket and an element.  Its number of slots is fixed during
+// concurrent use (initially Slots, rounded up to a power of 2), and
+// an insertion beyond 7/8 of the slots throws an exception; call
+// cache::reserve(n) before concurrent use to accommodate n entries.
+// See detail/open_addressing_map.h for details.
+//
+// The dense_backend selects an array-backed implementation of the
+// core cache interface for keys with a dense_key_traits
+// specialization (see detail/dense_cache.h).  It does not provide
+// the members above.
+// ====================================================================
+
+#include "hep_concurrency/detail/open_addressing_map.h"
+#include "tbb/concurrent_hash_map.h"
+#include "tbb/concurrent_unordered_map.h"
+
+#include <cstddef>
+
+namespace hep::concurrency {
+
+  struct tbb_backend {
+    template <typename Key, typename T, typename HashCompare>
+    using map = tbb::concurrent_hash_map<Key, T, HashCompare>;
+
+    template <typename Key, typename T, typename Hasher>
+    using index = tbb::concurrent_unordered_map<Key, T, Hasher>;
+
+    // A concurrent_hash_map bucket holds a lock and a list head, and
+    // each node a lock and a link; a concurrent_unordered_map bucket
+    // holds a pointer, and each node a link and an order key.
+    static constexpr std::size_t map_bucket_bytes{2 * sizeof(void*)};
+    static constexpr std::size_t map_node_bytes{2 * sizeof(void*)};
+    static constexpr std::size_t index_bucket_bytes{sizeof(void*)};
+    static constexpr std::size_t index_node_bytes{sizeof(void*) +
+                                                  sizeof(std::size_t)};
+  };
+
+  struct dense_backend {};
+
+  template <std::size_t Slots = 1024>
+  struct open_addressing_backend {
+    template <typename Key, typename T, typename HashCompare>
+    using map = detail::open_addressing_map<Key, T, HashCompare, Slots>;
+
+    template <typename Key, typename T, typename Hasher>
+    using index = tbb::concurrent_unordered_map<Key, T, Hasher>;
+
+    // Each slot holds a lock, a state, a hash value and a pointer to
+    // the separately allocated element, which carries no other
+    // overhead.
+    static constexpr std::size_t map_bucket_bytes{
+      sizeof(detail::open_addressing_slot<void>)};
+    static constexpr std::size_t map_node_bytes{0ull};
+    static constexpr std::size_t index_bucket_bytes{
+      tbb_backend::index_bucket_bytes};
+    static constexpr std::size_t index_node_bytes{
+      tbb_backend::index_node_bytes};
+  };
+}
+
+#endif /* hep_concurrency_cache_backends_h */
+
+// Local Variables:
+// mode: c++
+// End:
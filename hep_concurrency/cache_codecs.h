@@ -0,0 +1,115 @@
+#ifndef hep_concurrency_cache_codecs_h
+#define hep_concurrency_cache_codecs_h
+
+// ====================================================================
+// Codecs used by cache::compress_unused(...) to keep cold values in
+// compressed form (see "Compression of cold values" in cache.h).
+//
+// A codec for values of type V is any copyable type that provides:
+//
+//   struct my_codec {
+//     std::vector<std::byte> compress(V const& value) const;
+//     V decompress(std::span<std::byte const> bytes) const;
+//   };
+//
+// Wrapping a general-purpose compression library (e.g. LZ4 or zlib)
+// is left to the user.  The run_length_codec provided here is suited
+// to sparse tables--i.e. vectors in which long runs of identical
+// elements (typically zeros) are common.
+// ====================================================================
+
+#include "cetlib_except/exception.h"
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+namespace hep::concurrency {
+
+  namespace detail {
+    template <typename C, typename Value>
+    concept value_codec =
+      std::copy_constructible<C> and
+      requires(C const& codec,
+               Value const& value,
+               std::span<std::byte const> bytes) {
+        {
+          codec.compress(value)
+          } -> std::same_as<std::vector<std::byte>>;
+        {
+          codec.decompress(bytes)
+          } -> std::convertible_to<Value>;
+      };
+  }
+
+  // Encodes a std::vector<T> as a sequence of (run length, element)
+  // records.  Elements are compared bitwise.
+  template <typename T>
+    requires std::is_trivially_copyable_v<T>
+  class run_length_codec {
+  public:
+    std::vector<std::byte>
+    compress(std::vector<T> const& values) const
+    {
+      std::vector<std::byte> result;
+      auto it = cbegin(values);
+      auto const end = cend(values);
+      while (it != end) {
+        auto run_end = it + 1;
+        while (run_end != end and run_end - it < max_run and
+               std::memcmp(&*run_end, &*it, sizeof(T)) == 0) {
+          ++run_end;
+        }
+        auto const length = static_cast<run_length_t>(run_end - it);
+        append(result, &length, sizeof(length));
+        append(result, &*it, sizeof(T));
+        it = run_end;
+      }
+      return result;
+    }
+
+    std::vector<T>
+    decompress(std::span<std::byte const> bytes) const
+    {
+      if (std::size(bytes) % record_size != 0ull) {
+        throw cet::exception("Cache decompression error.")
+          << "The size of the run-length encoded data (" << std::size(bytes)
+          << " bytes) is not a multiple of the record size (" << record_size
+          << " bytes).";
+      }
+
+      std::vector<T> result;
+      for (auto p = bytes.data(); p != bytes.data() + std::size(bytes);
+           p += record_size) {
+        run_length_t length;
+        std::memcpy(&length, p, sizeof(length));
+        T element;
+        std::memcpy(&element, p + sizeof(length), sizeof(T));
+        result.insert(end(result), length, element);
+      }
+      return result;
+    }
+
+  private:
+    using run_length_t = std::uint32_t;
+    static constexpr std::ptrdiff_t max_run = UINT32_MAX;
+    static constexpr std::size_t record_size = sizeof(run_length_t) + sizeof(T);
+
+    static void
+    append(std::vector<std::byte>& bytes, void const* p, std::size_t const n)
+    {
+      auto const* first = static_cast<std::byte const*>(p);
+      bytes.insert(end(bytes), first, first + n);
+    }
+  };
+}
+
+#endif /* hep_concurrency_cache_codecs_h */
+
+// Local Variables:
+// mode: c++
+// End:
@@ -3,9 +3,38 @@
 
 #include "detail/cache_hashers.h"
 
+#include <concepts>
+#include <cstddef>
+
 namespace hep::concurrency {
-  template <detail::hashable_cache_key Key, typename Value>
+  // Storage backends (see cache_backends.h)
+  struct tbb_backend;
+  struct dense_backend;
+
+  template <detail::hashable_cache_key Key,
+            typename Value,
+            typename Backend = tbb_backend>
   class cache;
+
+  // Specialize for keys that map onto a small, dense range of indices
+  // [0, extent), injectively, to allow the use of the array-backed
+  // cache implementation, cache<Key, Value, dense_backend> (see
+  // detail/dense_cache.h).  The specialization must be visible
+  // wherever the cache is used.
+  template <typename Key>
+  struct dense_key_traits;
+
+  namespace detail {
+    template <typename Key>
+    concept dense_cache_key = requires(Key const& key) {
+                                {
+                                  dense_key_traits<Key>::extent
+                                  } -> std::convertible_to<std::size_t>;
+                                {
+                                  dense_key_traits<Key>::index(key)
+                                  } -> std::convertible_to<std::size_t>;
+                              };
+  }
 }
 
 #endif /* hep_concurrency_cache_fwd_h */
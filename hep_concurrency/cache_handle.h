@@ -26,7 +26,9 @@
 //     functions is provided via operator->.
 //
 // N.B. A handle cannot in any way adjust the underlying value.  It is
-//      considered immutable.
+//      considered immutable.  If the entry's value is replaced (see
+//      cache::replace), the handle continues to refer to the version
+//      it was created with.
 // ====================================================================
 
 #include "cetlib_except/exception.h"
@@ -45,8 +47,8 @@ namespace hep::concurrency {
 
     cache_handle(cache_handle const& other);
     cache_handle& operator=(cache_handle const& other);
-    cache_handle(cache_handle&& other);
-    cache_handle& operator=(cache_handle&& other);
+    cache_handle(cache_handle&& other) noexcept;
+    cache_handle& operator=(cache_handle&& other) noexcept;
 
     // Check whether handle points to valid cache entry
     bool is_valid() const noexcept;
@@ -66,10 +68,26 @@ namespace hep::concurrency {
     void invalidate() noexcept;
 
   private:
+    template <detail::hashable_cache_key, typename, typename>
+    friend class cache;
+
+    struct adopt_reference_t {};
+    static constexpr adopt_reference_t adopt_reference{};
+
     constexpr cache_handle() = default;
 
+    // Takes over a reference count already incremented by the caller.
+    cache_handle(Key const* key,
+                 Value const* value,
+                 detail::entry_count* count,
+                 adopt_reference_t) noexcept
+      : key_{key}, value_{value}, count_{count}
+    {}
+
+    // The value and reference count of one version of an entry
     Key const* key_{nullptr};
-    detail::cache_entry<Value>* entry_{nullptr};
+    Value const* value_{nullptr};
+    detail::entry_count* count_{nullptr};
   };
 
   // ----------------------------------------------------------------------------
@@ -85,19 +103,21 @@ namespace hep::concurrency {
   template <typename Key, typename Value>
   cache_handle<Key, Value>::cache_handle(Key const* key,
                                          detail::cache_entry<Value>* entry)
-    : key_{key}, entry_{entry}
+    : key_{key}
+    , value_{entry ? entry->value_pointer() : nullptr}
+    , count_{entry ? entry->counter() : nullptr}
   {
-    if (entry_) {
-      entry_->increment_reference_count();
+    if (count_) {
+      ++count_->use_count;
     }
   }
 
   template <typename Key, typename Value>
   cache_handle<Key, Value>::cache_handle(cache_handle const& other)
-    : key_{other.key_}, entry_{other.entry_}
+    : key_{other.key_}, value_{other.value_}, count_{other.count_}
   {
-    if (entry_) {
-      entry_->increment_reference_count();
+    if (count_) {
+      ++count_->use_count;
     }
   }
 
@@ -105,29 +125,37 @@ namespace hep::concurrency {
   cache_handle<Key, Value>&
   cache_handle<Key, Value>::operator=(cache_handle const& other)
   {
-    if (other.entry_) {
-      other.entry_->increment_reference_count();
+    if (other.count_) {
+      ++other.count_->use_count;
     }
 
     invalidate();
     key_ = other.key_;
-    entry_ = other.entry_;
+    value_ = other.value_;
+    count_ = other.count_;
     return *this;
   }
 
   template <typename Key, typename Value>
-  cache_handle<Key, Value>::cache_handle(cache_handle&& other)
-    : cache_handle{other} // Use copy c'tor
+  cache_handle<Key, Value>::cache_handle(cache_handle&& other) noexcept
+    : key_{std::exchange(other.key_, nullptr)}
+    , value_{std::exchange(other.value_, nullptr)}
+    , count_{std::exchange(other.count_, nullptr)}
   {
-    other.invalidate();
+    // The reference held by 'other' is transferred to this handle, so
+    // the reference count is left unchanged.
   }
 
   template <typename Key, typename Value>
   cache_handle<Key, Value>&
-  cache_handle<Key, Value>::operator=(cache_handle&& other)
+  cache_handle<Key, Value>::operator=(cache_handle&& other) noexcept
   {
-    *this = other; // Use copy assignment operator
-    other.invalidate();
+    if (this != &other) {
+      invalidate();
+      key_ = std::exchange(other.key_, nullptr);
+      value_ = std::exchange(other.value_, nullptr);
+      count_ = std::exchange(other.count_, nullptr);
+    }
     return *this;
   }
 
@@ -135,18 +163,18 @@ namespace hep::concurrency {
   bool
   cache_handle<Key, Value>::is_valid() const noexcept
   {
-    return key_ != nullptr and entry_ != nullptr;
+    return key_ != nullptr and count_ != nullptr;
   }
 
   template <typename Key, typename Value>
   Value const&
   cache_handle<Key, Value>::operator*() const
   {
-    if (entry_ == nullptr) {
+    if (value_ == nullptr) {
       throw cet::exception("Invalid cache handle dereference.")
         << "Handle does not refer to any cache entry.";
     }
-    return entry_->get();
+    return *value_;
   }
 
   template <typename Key, typename Value>
@@ -171,11 +199,11 @@ namespace hep::concurrency {
   std::size_t
   cache_handle<Key, Value>::sequence_number() const
   {
-    if (entry_ == nullptr) {
+    if (count_ == nullptr) {
       throw cet::exception("Invalid sequence-number access.")
         << "Handle does not refer to any cache entry.";
     }
-    return entry_->sequence_number();
+    return count_->sequence_number;
   }
 
   template <typename Key, typename Value>
@@ -185,7 +213,7 @@ namespace hep::concurrency {
     if (this == &handle) {
       return true;
     }
-    return key_ == handle.key_ and entry_ == handle.entry_;
+    return key_ == handle.key_ and count_ == handle.count_;
   }
 
   template <typename Key, typename Value>
@@ -199,11 +227,12 @@ namespace hep::concurrency {
   void
   cache_handle<Key, Value>::invalidate() noexcept
   {
-    if (key_ != nullptr and entry_ != nullptr) {
-      entry_->decrement_reference_count();
+    if (key_ != nullptr and count_ != nullptr) {
+      --count_->use_count;
     }
     key_ = nullptr;
-    entry_ = nullptr;
+    value_ = nullptr;
+    count_ = nullptr;
   }
 
 }
@@ -0,0 +1,273 @@
+#ifndef hep_concurrency_cache_reaper_h
+#define hep_concurrency_cache_reaper_h
+
+// ====================================================================
+// A cache_reaper removes unused entries from a cache in the
+// background, so that no caller of the cache needs to invoke
+// drop_unused_but_last(...) on its critical path:
+//
+//   tbb::task_group group;
+//   cache<iov, calibration> calibrations;
+//   cache_reaper reaper{calibrations, group,
+//                       {.max_entries = 100, .keep_last = 10}};
+//   ...
+//   group.wait();
+//
+// The reaper registers an insertion hook with the cache (see
+// cache::set_insertion_hook), so a cache can have only one reaper;
+// constructing a second throws an exception.  After each insertion,
+// the hook checks the thresholds below; if one is exceeded, a cleanup
+// pass is pushed onto a SerialTaskQueue owned by the reaper, whose
+// tasks are run by the user's tbb::task_group.  A pass removes all
+// unused entries except the most recent keep_last ones, but in slices
+// of at most 'slice' entries: each slice is a separate task, so a
+// long pass does not monopolize a worker thread.  The entries to
+// remove are chosen once, when the pass starts (see
+// cache::unused_keys_but_last); a slice skips any of them that has
+// been used since.  While a pass is scheduled or running, the
+// thresholds are not checked.
+//
+// Thresholds are only evaluated upon insertion.  The memory footprint
+// (see cache::memory_usage) is expensive to compute, so it is sampled
+// once per 'sample_every' insertions, and in the cleanup task rather
+// than in the hook.
+//
+// Both 'slice' and 'sample_every' must be positive.
+//
+// The reaper must be destroyed before the cache, and only once no
+// entries are being inserted concurrently.  Its destructor cancels a
+// scheduled pass; if a slice of the pass is running, the destructor
+// waits for that slice to complete.
+// ====================================================================
+
+#include "hep_concurrency/SerialTaskQueue.h"
+#include "hep_concurrency/cache.h"
+#include "cetlib_except/exception.h"
+#include "tbb/task_group.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace hep::concurrency {
+
+  struct reaper_thresholds {
+    static constexpr auto none = std::numeric_limits<std::size_t>::max();
+
+    // Triggers: number of entries, estimated bytes, and time since
+    // the last pass.
+    std::size_t max_entries{none};
+    std::size_t max_bytes{none};
+    std::chrono::steady_clock::duration interval{
+      std::chrono::steady_clock::duration::max()};
+
+    // Cleanup behavior
+    std::size_t keep_last{0ull};
+    std::size_t slice{64ull};
+    std::size_t sample_every{64ull};
+  };
+
+  template <typename Key, typename Value, typename Backend = tbb_backend>
+  class cache_reaper {
+  public:
+    cache_reaper(cache<Key, Value, Backend>& c,
+                 tbb::task_group& group,
+                 reaper_thresholds const& thresholds);
+    ~cache_reaper();
+
+    // Disable copy operations
+    cache_reaper(cache_reaper const&) = delete;
+    cache_reaper& operator=(cache_reaper const&) = delete;
+
+    // Schedule a cleanup pass regardless of the thresholds.
+    void request();
+
+    std::size_t
+    passes() const noexcept
+    {
+      return passes_;
+    }
+    std::size_t
+    reaped() const noexcept
+    {
+      return reaped_;
+    }
+
+  private:
+    enum class trigger { none, limit, bytes };
+
+    // Shared with the queued tasks, which may outlive the reaper.  A
+    // task runs a slice only while holding the mutex, and only if
+    // the reaper has not been destroyed.
+    struct control {
+      std::mutex mutex;
+      bool cancelled{false};
+    };
+
+    trigger check_() noexcept;
+    void schedule_(trigger t);
+    void push_slice_(trigger t);
+    void run_slice_(trigger t);
+    void finish_pass_();
+
+    cache<Key, Value, Backend>& cache_;
+    reaper_thresholds const thresholds_;
+    // Each task keeps the queue alive, as the queue is still used
+    // after the reaper may have been destroyed (see ~cache_reaper).
+    std::shared_ptr<SerialTaskQueue> queue_;
+    std::shared_ptr<control> control_{std::make_shared<control>()};
+    // Used only by the queued tasks, which are serialized.
+    std::vector<Key> candidates_{};
+    std::size_t next_candidate_{0ull};
+    std::atomic<bool> scheduled_{false};
+    std::atomic<std::size_t> insertions_{0ull};
+    std::atomic<std::chrono::steady_clock::rep> last_pass_;
+    std::atomic<std::size_t> passes_{0ull};
+    std::atomic<std::size_t> reaped_{0ull};
+  };
+
+  // ----------------------------------------------------------------------------
+  // Implementation below
+
+  template <typename Key, typename Value, typename Backend>
+  cache_reaper<Key, Value, Backend>::cache_reaper(
+    cache<Key, Value, Backend>& c,
+    tbb::task_group& group,
+    reaper_thresholds const& thresholds)
+    : cache_{c}
+    , thresholds_{thresholds}
+    , queue_{std::make_shared<SerialTaskQueue>(group)}
+    , last_pass_{std::chrono::steady_clock::now().time_since_epoch().count()}
+  {
+    if (thresholds_.slice == 0ull or thresholds_.sample_every == 0ull) {
+      throw cet::exception("Cache reaper error.")
+        << "The slice size and the sampling period must be positive.\n";
+    }
+    cache_.set_insertion_hook([this] {
+      if (scheduled_) {
+        return;
+      }
+      if (auto const t = check_(); t != trigger::none) {
+        schedule_(t);
+      }
+    });
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  cache_reaper<Key, Value, Backend>::~cache_reaper()
+  {
+    // Waiting for a pending pass to be run could hang if no other
+    // thread is available to run it, so the pass is cancelled
+    // instead.  The tasks still refer to the queue and to the
+    // control block, but no longer to the reaper.
+    cache_.set_insertion_hook(nullptr);
+    std::lock_guard lock{control_->mutex};
+    control_->cancelled = true;
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  void
+  cache_reaper<Key, Value, Backend>::request()
+  {
+    schedule_(trigger::limit);
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  auto
+  cache_reaper<Key, Value, Backend>::check_() noexcept -> trigger
+  {
+    if (cache_.size() > thresholds_.max_entries) {
+      return trigger::limit;
+    }
+    auto const now = std::chrono::steady_clock::now().time_since_epoch();
+    auto const last_pass = std::chrono::steady_clock::duration{last_pass_};
+    if (now - last_pass >= thresholds_.interval) {
+      return trigger::limit;
+    }
+    if (thresholds_.max_bytes != reaper_thresholds::none and
+        ++insertions_ % thresholds_.sample_every == 0ull) {
+      return trigger::bytes;
+    }
+    return trigger::none;
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  void
+  cache_reaper<Key, Value, Backend>::schedule_(trigger const t)
+  {
+    if (scheduled_.exchange(true)) {
+      // A pass is already scheduled or running.
+      return;
+    }
+    push_slice_(t);
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  void
+  cache_reaper<Key, Value, Backend>::push_slice_(trigger const t)
+  {
+    queue_->push([this, t, queue = queue_, control = control_] {
+      std::lock_guard lock{control->mutex};
+      if (not control->cancelled) {
+        run_slice_(t);
+      }
+    });
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  void
+  cache_reaper<Key, Value, Backend>::run_slice_(trigger const t)
+  {
+    try {
+      if (t == trigger::bytes and
+          cache_.memory_usage().total() <= thresholds_.max_bytes) {
+        finish_pass_();
+        return;
+      }
+      if (next_candidate_ == 0ull) {
+        candidates_ = cache_.unused_keys_but_last(thresholds_.keep_last);
+      }
+      auto const n = std::min(thresholds_.slice,
+                              std::size(candidates_) - next_candidate_);
+      for (auto const end = next_candidate_ + n; next_candidate_ != end;
+           ++next_candidate_) {
+        if (cache_.erase_if_unused(candidates_[next_candidate_])) {
+          ++reaped_;
+        }
+      }
+      if (next_candidate_ != std::size(candidates_)) {
+        // Continue in a new task, which checks the footprint again
+        // if that triggered the pass.
+        push_slice_(t);
+        return;
+      }
+    }
+    catch (...) {
+      // The SerialTaskQueue would discard the exception anyway; end
+      // the pass so that a later insertion can schedule another one.
+    }
+    finish_pass_();
+  }
+
+  template <typename Key, typename Value, typename Backend>
+  void
+  cache_reaper<Key, Value, Backend>::finish_pass_()
+  {
+    candidates_.clear();
+    next_candidate_ = 0ull;
+    last_pass_ = std::chrono::steady_clock::now().time_since_epoch().count();
+    ++passes_;
+    scheduled_ = false;
+  }
+}
+
+#endif /* hep_concurrency_cache_reaper_h */
+
+// Local Variables:
+// mode: c++
+// End:
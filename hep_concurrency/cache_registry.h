@@ -0,0 +1,268 @@
+#ifndef hep_concurrency_cache_registry_h
+#define hep_concurrency_cache_registry_h
+
+// ====================================================================
+// A cache_registry enforces one memory budget across all caches that
+// are enrolled in it, instead of each cache being cleaned up with its
+// own retention policy:
+//
+//   cache_registry registry{2ull << 30}; // 2 GiB
+//   auto const geometry = registry.enroll(geometry_cache, "geometry");
+//   auto const pedestals = registry.enroll(pedestal_cache, "pedestals");
+//   ...
+//   registry.enforce_budget(); // E.g. at the end of each event
+//
+// When the estimated footprint of the enrolled caches (see "Memory
+// usage" in cache.h) exceeds the budget, enforce_budget() removes
+// unused entries, regardless of the cache they belong to, until the
+// footprint is within the budget.  Entries are removed in decreasing
+// order of the product of their size and the time since they were
+// last accessed, so large entries that have not been used for a long
+// time are removed first, and caches that see little traffic yield
+// memory to the busy ones.  An entry that is in use is never removed.
+//
+// Enrolling a cache makes it record the time of each access (see
+// cache::track_access_times()).  The value returned by enroll(...)
+// withdraws the cache from the registry when destroyed; it must be
+// destroyed before the cache.  The sizes of values are estimated as
+// described in cache.h; a function that estimates the storage owned
+// by a value may be passed to enroll(...).
+//
+// All member functions may be called concurrently with each other
+// and with the use of the enrolled caches, except that a cache must
+// be enrolled before it is used concurrently.  Calls to
+// enforce_budget() are serialized.
+// ====================================================================
+
+#include "hep_concurrency/cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hep::concurrency {
+
+  class cache_registry {
+  public:
+    class enrollment;
+
+    struct cache_report {
+      std::string name;
+      cache_memory_usage usage;
+    };
+
+    explicit cache_registry(std::size_t const budget_bytes)
+      : budget_{budget_bytes}
+    {}
+
+    template <typename Key,
+              typename Value,
+              typename Backend,
+              detail::size_estimator<Value> F = detail::owned_storage>
+    [[nodiscard]] enrollment enroll(cache<Key, Value, Backend>& c,
+                                    std::string name = {},
+                                    F value_storage = {});
+
+    // Removes unused entries until the estimated footprint of the
+    // enrolled caches is within the budget, or no unused entries
+    // remain.  Returns the number of removed entries.
+    std::size_t enforce_budget();
+
+    std::size_t
+    budget() const noexcept
+    {
+      return budget_;
+    }
+    std::vector<cache_report> usage() const;
+
+  private:
+    using clock = std::chrono::steady_clock;
+
+    // An unused entry of one of the caches
+    struct candidate {
+      double score;
+      std::size_t bytes;
+      std::size_t cache;
+      std::size_t entry;
+    };
+
+    struct enrolled_cache {
+      explicit enrolled_cache(std::string name) : name{std::move(name)} {}
+      virtual ~enrolled_cache() = default;
+      virtual cache_memory_usage usage() const = 0;
+      // Collects the unused entries; the index of each entry refers
+      // to the collection until the next call.
+      virtual void collect(std::vector<candidate>& candidates,
+                           std::size_t cache,
+                           clock::time_point now) = 0;
+      virtual bool erase(std::size_t entry) = 0;
+
+      std::string const name;
+    };
+
+    template <typename Key, typename Value, typename Backend, typename F>
+    class enrolled_cache_for;
+
+    void withdraw(enrolled_cache const* c);
+
+    std::size_t const budget_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<enrolled_cache>> caches_;
+  };
+
+  // Withdraws the cache from the registry upon destruction
+  class cache_registry::enrollment {
+  public:
+    enrollment(enrollment&& other) noexcept
+      : registry_{std::exchange(other.registry_, nullptr)}
+      , cache_{other.cache_}
+    {}
+    enrollment& operator=(enrollment&&) = delete;
+    ~enrollment()
+    {
+      if (registry_) {
+        registry_->withdraw(cache_);
+      }
+    }
+
+  private:
+    friend class cache_registry;
+    enrollment(cache_registry* registry, enrolled_cache const* c) noexcept
+      : registry_{registry}, cache_{c}
+    {}
+
+    cache_registry* registry_;
+    enrolled_cache const* cache_;
+  };
+
+  template <typename Key, typename Value, typename Backend, typename F>
+  class cache_registry::enrolled_cache_for : public enrolled_cache {
+  public:
+    enrolled_cache_for(cache<Key, Value, Backend>& c,
+                       std::string name,
+                       F value_storage)
+      : enrolled_cache{std::move(name)}
+      , cache_{c}
+      , value_storage_{std::move(value_storage)}
+    {}
+
+    cache_memory_usage
+    usage() const override
+    {
+      return cache_.memory_usage(value_storage_);
+    }
+
+    void
+    collect(std::vector<candidate>& candidates,
+            std::size_t const index,
+            clock::time_point const now) override
+    {
+      unused_ = cache_.unused_entries(value_storage_);
+      for (std::size_t i{}; i != std::size(unused_); ++i) {
+        auto const& entry = unused_[i];
+        std::chrono::duration<double> const idle = now - entry.last_access;
+        candidates.push_back({std::max(idle.count(), 0.) * entry.bytes,
+                              entry.bytes,
+                              index,
+                              i});
+      }
+    }
+
+    bool
+    erase(std::size_t const entry) override
+    {
+      return cache_.erase_if_unused(unused_[entry].key);
+    }
+
+  private:
+    cache<Key, Value, Backend>& cache_;
+    F value_storage_;
+    std::vector<cache_unused_entry<Key>> unused_{};
+  };
+
+  // ----------------------------------------------------------------------------
+  // Implementation below
+
+  template <typename Key,
+            typename Value,
+            typename Backend,
+            detail::size_estimator<Value> F>
+  auto
+  cache_registry::enroll(cache<Key, Value, Backend>& c,
+                         std::string name,
+                         F value_storage) -> enrollment
+  {
+    c.track_access_times();
+    using enrolled_t = enrolled_cache_for<Key, Value, Backend, F>;
+    auto enrolled = std::make_unique<enrolled_t>(
+      c, std::move(name), std::move(value_storage));
+    auto const* result = enrolled.get();
+    std::lock_guard sentry{mutex_};
+    caches_.push_back(std::move(enrolled));
+    return enrollment{this, result};
+  }
+
+  inline void
+  cache_registry::withdraw(enrolled_cache const* c)
+  {
+    std::lock_guard sentry{mutex_};
+    std::erase_if(caches_, [c](auto const& p) { return p.get() == c; });
+  }
+
+  inline auto
+  cache_registry::usage() const -> std::vector<cache_report>
+  {
+    std::lock_guard sentry{mutex_};
+    std::vector<cache_report> result;
+    for (auto const& c : caches_) {
+      result.push_back({c->name, c->usage()});
+    }
+    return result;
+  }
+
+  inline std::size_t
+  cache_registry::enforce_budget()
+  {
+    std::lock_guard sentry{mutex_};
+    std::size_t total{};
+    for (auto const& c : caches_) {
+      total += c->usage().total();
+    }
+    if (total <= budget_) {
+      return 0ull;
+    }
+
+    std::vector<candidate> candidates;
+    auto const now = clock::now();
+    for (std::size_t i{}; i != std::size(caches_); ++i) {
+      caches_[i]->collect(candidates, i, now);
+    }
+    std::sort(begin(candidates),
+              end(candidates),
+              [](auto const& a, auto const& b) { return a.score > b.score; });
+
+    std::size_t n_removed{};
+    for (auto const& c : candidates) {
+      if (total <= budget_) {
+        break;
+      }
+      // The entry may have been taken since it was collected.
+      if (caches_[c.cache]->erase(c.entry)) {
+        total -= std::min(total, c.bytes);
+        ++n_removed;
+      }
+    }
+    return n_removed;
+  }
+}
+
+#endif /* hep_concurrency_cache_registry_h */
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,302 @@
+#ifndef hep_concurrency_coroutine_h
+#define hep_concurrency_coroutine_h
+
+// ====================================================================
+// Coroutine support for serialized work.  Instead of nesting lambdas
+// pushed onto SerialTaskQueues and WaitingTaskLists, a multi-step
+// computation can be written as a coroutine returning task<T>:
+//
+//   task<void>
+//   write_event(SerialTaskQueue& output, tbb::task_group& group, event e)
+//   {
+//     auto summary = summarize(e);    // Runs concurrently
+//     co_await output.schedule();     // Now serialized with other users
+//     write(summary);
+//     co_await schedule(group);       // Releases the output queue
+//     cleanup(e);
+//   }
+//
+//   auto const done = spawn(group, write_event(output, group, e));
+//   done->add(next_step);             // Receives any exception thrown
+//
+// - A task<T> is started lazily: its body runs only once the task is
+//   awaited by another coroutine, or spawned on a task group.
+//
+// - co_await queue.schedule() resumes the coroutine as a task of the
+//   queue.  The coroutine holds the queue until it completes or
+//   suspends again, e.g. on co_await schedule(group), which resumes it
+//   as a task of the group and lets the queue start its next task.
+//
+// - co_await std::move(t), for a task<T> t, runs t's body and then
+//   resumes the awaiting coroutine on the same thread, with t's
+//   result, or with the exception that t's body threw.  A task can be
+//   awaited only once, so only rvalues are awaitable; a task returned
+//   by a call is awaited directly, as in co_await f().
+//
+// - spawn(group, t) runs t's body as a task of the group, and returns
+//   a WaitingTaskList on which doneWaiting is called, with the
+//   exception thrown by the body (if any), when the body completes.
+//   The value returned by the body is discarded.  The coroutine frame
+//   is destroyed upon completion.
+//
+// A call to group.wait() returns once the group has no task left,
+// which does not imply that the coroutines spawned on it have
+// completed.  A coroutine suspended on co_await queue.schedule() is
+// resumed as a task of the group the queue was constructed with,
+// which may be another group, and not at all while the queue is
+// paused.  Use the WaitingTaskList returned by spawn(...) to be
+// notified of a coroutine's completion.
+// ====================================================================
+
+#include "hep_concurrency/SerialTaskQueue.h"
+#include "hep_concurrency/WaitingTaskList.h"
+#include "tbb/task_group.h"
+
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace hep::concurrency {
+
+  template <typename T = void>
+  class task;
+
+  namespace detail {
+
+    class task_promise_base {
+    public:
+      std::suspend_always
+      initial_suspend() const noexcept
+      {
+        return {};
+      }
+
+      auto
+      final_suspend() const noexcept
+      {
+        return final_awaiter{};
+      }
+
+      void
+      unhandled_exception() noexcept
+      {
+        exception_ = std::current_exception();
+      }
+
+      void
+      set_continuation(std::coroutine_handle<> const h) noexcept
+      {
+        continuation_ = h;
+      }
+
+      void
+      set_done(std::shared_ptr<WaitingTaskList> done) noexcept
+      {
+        done_ = std::move(done);
+      }
+
+      void
+      rethrow_if_failed() const
+      {
+        if (exception_) {
+          std::rethrow_exception(exception_);
+        }
+      }
+
+    private:
+      struct final_awaiter {
+        bool
+        await_ready() const noexcept
+        {
+          return false;
+        }
+
+        // Resumes the awaiting coroutine, if any; otherwise the task
+        // was spawned and owns its frame.
+        template <typename Promise>
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<Promise> const h) const noexcept
+        {
+          auto& promise = h.promise();
+          if (promise.continuation_) {
+            return promise.continuation_;
+          }
+          auto done = std::move(promise.done_);
+          auto const exception = promise.exception_;
+          h.destroy();
+          if (done) {
+            done->doneWaiting(exception);
+          }
+          return std::noop_coroutine();
+        }
+
+        void
+        await_resume() const noexcept
+        {}
+      };
+
+      std::coroutine_handle<> continuation_{};
+      std::exception_ptr exception_{};
+      std::shared_ptr<WaitingTaskList> done_{};
+    };
+
+    template <typename T>
+    class task_promise : public task_promise_base {
+    public:
+      task<T> get_return_object() noexcept;
+
+      template <typename U>
+        requires std::convertible_to<U&&, T>
+      void
+      return_value(U&& value)
+      {
+        value_.emplace(std::forward<U>(value));
+      }
+
+      T
+      result()
+      {
+        rethrow_if_failed();
+        return std::move(*value_);
+      }
+
+    private:
+      std::optional<T> value_{};
+    };
+
+    template <>
+    class task_promise<void> : public task_promise_base {
+    public:
+      task<void> get_return_object() noexcept;
+
+      void
+      return_void() const noexcept
+      {}
+
+      void
+      result() const
+      {
+        rethrow_if_failed();
+      }
+    };
+  }
+
+  template <typename T>
+  class task {
+  public:
+    using promise_type = detail::task_promise<T>;
+
+    task(task&& other) noexcept : handle_{std::exchange(other.handle_, {})}
+    {}
+    task& operator=(task&&) = delete;
+    ~task()
+    {
+      if (handle_) {
+        handle_.destroy();
+      }
+    }
+
+    // Awaiting a task runs its body; see the top of this file.
+    auto operator co_await() && noexcept;
+
+  private:
+    friend promise_type;
+    template <typename U>
+    friend std::shared_ptr<WaitingTaskList> spawn(tbb::task_group&, task<U>);
+
+    explicit task(std::coroutine_handle<promise_type> const h) noexcept
+      : handle_{h}
+    {}
+
+    std::coroutine_handle<promise_type> handle_;
+  };
+
+  // Returns an awaitable that resumes the awaiting coroutine as a task
+  // of the group.
+  inline auto
+  schedule(tbb::task_group& group) noexcept
+  {
+    struct awaiter {
+      bool
+      await_ready() const noexcept
+      {
+        return false;
+      }
+      void
+      await_suspend(std::coroutine_handle<> const h) const
+      {
+        group->run([h] { h.resume(); });
+      }
+      void
+      await_resume() const noexcept
+      {}
+
+      tbb::task_group* group;
+    };
+    return awaiter{&group};
+  }
+
+  template <typename T>
+  std::shared_ptr<WaitingTaskList>
+  spawn(tbb::task_group& group, task<T> t)
+  {
+    auto done = std::make_shared<WaitingTaskList>(group);
+    auto const h = std::exchange(t.handle_, {});
+    h.promise().set_done(done);
+    group.run([h] { h.resume(); });
+    return done;
+  }
+
+  // ----------------------------------------------------------------------------
+  // Implementation below
+
+  template <typename T>
+  task<T>
+  detail::task_promise<T>::get_return_object() noexcept
+  {
+    return task<T>{
+      std::coroutine_handle<task_promise<T>>::from_promise(*this)};
+  }
+
+  inline task<void>
+  detail::task_promise<void>::get_return_object() noexcept
+  {
+    return task<void>{
+      std::coroutine_handle<task_promise<void>>::from_promise(*this)};
+  }
+
+  template <typename T>
+  auto task<T>::operator co_await() && noexcept
+  {
+    struct awaiter {
+      bool
+      await_ready() const noexcept
+      {
+        return false;
+      }
+      std::coroutine_handle<>
+      await_suspend(std::coroutine_handle<> const awaiting) const noexcept
+      {
+        handle.promise().set_continuation(awaiting);
+        return handle;
+      }
+      T
+      await_resume() const
+      {
+        return handle.promise().result();
+      }
+
+      std::coroutine_handle<promise_type> handle;
+    };
+    return awaiter{handle_};
+  }
+}
+
+#endif /* hep_concurrency_coroutine_h */
+
+// Local Variables:
+// mode: c++
+// End:
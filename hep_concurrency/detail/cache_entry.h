@@ -13,7 +13,13 @@
 #include "hep_concurrency/cache_fwd.h"
 
 #include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <concepts>
 #include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace hep::concurrency::detail {
   struct entry_count {
@@ -22,6 +28,10 @@ namespace hep::concurrency::detail {
     {}
     std::size_t sequence_number;
     std::atomic<unsigned int> use_count;
+    // Time of the last access, in std::chrono::steady_clock ticks.
+    // Updated only if the cache compresses cold values or tracks
+    // access times.
+    std::atomic<std::chrono::steady_clock::rep> last_access{};
   };
 
   using entry_count_ptr = std::shared_ptr<entry_count>;
@@ -44,11 +54,16 @@ namespace hep::concurrency::detail {
     cache_entry() = default;
 
     template <typename U = T>
+      requires(not std::same_as<std::remove_cvref_t<U>, std::unique_ptr<T>>)
     cache_entry(U&& u, entry_count_ptr counter)
       : value_{std::make_unique<T>(std::forward<U>(u))}
       , count_{std::move(counter)}
     {}
 
+    cache_entry(std::unique_ptr<T> value, entry_count_ptr counter)
+      : value_{std::move(value)}, count_{std::move(counter)}
+    {}
+
     T const&
     get() const
     {
@@ -59,17 +74,6 @@ namespace hep::concurrency::detail {
       return *value_;
     }
 
-    void
-    increment_reference_count()
-    {
-      ++count_->use_count;
-    }
-    void
-    decrement_reference_count()
-    {
-      --count_->use_count;
-    }
-
     std::size_t
     sequence_number() const noexcept
     {
@@ -82,13 +86,31 @@ namespace hep::concurrency::detail {
       return count_->use_count;
     }
 
+    // The current version, as referred to by a handle
+    T const*
+    value_pointer() const noexcept
+    {
+      return value_.get();
+    }
+    entry_count*
+    counter() const noexcept
+    {
+      return count_.get();
+    }
+
     template <::hep::concurrency::detail::hashable_cache_key Key,
-              typename Value>
+              typename Value,
+              typename Backend>
     friend class ::hep::concurrency::cache;
 
   private:
     std::unique_ptr<T> value_{nullptr};
+    // Non-null only while the value is held in compressed form, in
+    // which case value_ is null.
+    std::unique_ptr<std::vector<std::byte> const> compressed_{nullptr};
     entry_count_ptr count_{make_invalid_counter()};
+    // Replaced versions that were still referenced by handles
+    std::vector<std::pair<std::unique_ptr<T>, entry_count_ptr>> retired_{};
   };
 }
 
@@ -0,0 +1,331 @@
+#ifndef hep_concurrency_detail_dense_cache_h
+#define hep_concurrency_detail_dense_cache_h
+
+// ===================================================================
+// Array-backed cache for dense key domains
+// ----------------------------------------
+//
+// Many caches are keyed by a value within a known, dense range
+// (e.g. a run number or a channel ID).  For such keys, hashing into
+// the TBB maps used by the general cache implementation is
+// unnecessary.  If the key type has a dense_key_traits
+// specialization:
+//
+//   template <>
+//   struct hep::concurrency::dense_key_traits<channel_id> {
+//     static constexpr std::size_t extent = 4096;
+//     static std::size_t index(channel_id const id) { return id.value; }
+//   };
+//
+// then cache<channel_id, V, dense_backend> stores its entries in an
+// array of 'extent' slots, and the slot for a key is found by
+// indexing the array directly.  Each slot occupies its own cache line
+// and is guarded by a reader-writer spin lock, so lookups of
+// different keys do not contend with each other.  The stored key is
+// never compared with the key looked up, so index(key) must be
+// injective: distinct keys must have distinct indices.
+//
+// The dense implementation is selected only through the
+// dense_backend; a dense_key_traits specialization alone does not
+// change the implementation of cache<channel_id, V>.  The handle
+// semantics are the same as those of the general cache, but only the
+// core interface is supported: at, entry_for, visit, visit_for,
+// emplace, drop_unused(_but_last), size, empty, capacity, and
+// shrink_to_fit.  Facilities that require the rest of the interface
+// (e.g. cache_reaper, cache_registry, or the access log) must use
+// another backend.  Inserting a key whose index is not less than
+// 'extent' is an error.
+//
+// N.B. This header is included by cache.h and is not intended to be
+//      included directly.
+// ===================================================================
+
+#include "cetlib_except/exception.h"
+#include "hep_concurrency/assert_only_one_thread.h"
+#include "hep_concurrency/cache.h"
+#include "hep_concurrency/cache_handle.h"
+#include "hep_concurrency/detail/cache_entry.h"
+#include "tbb/spin_rw_mutex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace hep::concurrency {
+
+  template <detail::hashable_cache_key Key, typename Value>
+  class cache<Key, Value, dense_backend> {
+    static_assert(detail::dense_cache_key<Key>,
+                  "The dense_backend requires a dense_key_traits "
+                  "specialization for the key type.");
+    using traits = dense_key_traits<Key>;
+
+    struct alignas(64) slot {
+      mutable tbb::spin_rw_mutex mutex;
+      std::optional<Key> key;
+      std::optional<detail::cache_entry<Value>> entry;
+    };
+
+  public:
+    using mapped_type = detail::cache_entry<Value>;
+    using handle = cache_handle<Key, Value>;
+
+    // Concurrent operations
+    // ---------------------
+
+    handle at(Key const& key) const;
+
+    template <typename T>
+      requires detail::key_with_support_function<Key, T>
+    handle entry_for(T const& t) const;
+
+    template <typename T>
+      requires detail::key_with_support_function<Key, T>
+    handle entry_for(handle hint, T const& t) const;
+
+    template <std::invocable<Key const&, Value const&> F>
+    bool visit(Key const& key, F&& f) const;
+    template <typename T, std::invocable<Key const&, Value const&> F>
+      requires detail::key_with_support_function<Key, T>
+    bool visit_for(T const& t, F&& f) const;
+
+    template <typename T>
+      requires std::convertible_to<T, Value>
+    handle emplace(Key const& k, T&& value);
+
+    void drop_unused();
+    void drop_unused_but_last(std::size_t const keep_last);
+
+    // Thread-safe, but no synchronization
+    // -----------------------------------
+    size_t
+    size() const
+    {
+      return size_;
+    }
+    bool
+    empty() const
+    {
+      return size_ == 0ull;
+    }
+    size_t
+    capacity() const
+    {
+      return traits::extent;
+    }
+
+    // Thread-unsafe
+    // -------------
+    void shrink_to_fit();
+
+  private:
+    static std::size_t
+    index_for(Key const& key)
+    {
+      return traits::index(key);
+    }
+
+    std::unique_ptr<slot[]> slots_{std::make_unique<slot[]>(traits::extent)};
+    std::atomic<std::size_t> next_sequence_number_{0ull};
+    std::atomic<std::size_t> size_{0ull};
+  };
+
+  template <detail::hashable_cache_key Key, typename Value>
+  cache_handle<Key, Value>
+  cache<Key, Value, dense_backend>::at(Key const& key) const
+  {
+    auto const index = index_for(key);
+    if (index >= traits::extent) {
+      return handle::invalid();
+    }
+
+    auto& s = slots_[index];
+    tbb::spin_rw_mutex::scoped_lock lock{s.mutex, false};
+    if (not s.entry) {
+      return handle::invalid();
+    }
+    return handle{&*s.key, &*s.entry};
+  }
+
+  template <detail::hashable_cache_key Key, typename Value>
+  template <typename T>
+    requires detail::key_with_support_function<Key, T>
+  cache_handle<Key, Value>
+  cache<Key, Value, dense_backend>::entry_for(T const& t) const
+  {
+    auto result = handle::invalid();
+    for (std::size_t i = 0; i != traits::extent; ++i) {
+      auto& s = slots_[i];
+      tbb::spin_rw_mutex::scoped_lock lock{s.mutex, false};
+      if (not s.entry or not s.key->supports(t)) {
+        continue;
+      }
+      if (result) {
+        throw cet::exception("Data retrieval error.")
+          << "More than one key match.";
+      }
+      result = handle{&*s.key, &*s.entry};
+    }
+    return result;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value>
+  template <typename T>
+    requires detail::key_with_support_function<Key, T>
+  cache_handle<Key, Value>
+  cache<Key, Value, dense_backend>::entry_for(handle const hint, T const& t) const
+  {
+    if (hint and hint.key().supports(t)) {
+      return hint;
+    }
+    return entry_for(t);
+  }
+
+  template <detail::hashable_cache_key Key, typename Value>
+  template <std::invocable<Key const&, Value const&> F>
+  bool
+  cache<Key, Value, dense_backend>::visit(Key const& key, F&& f) const
+  {
+    auto const index = index_for(key);
+    if (index >= traits::extent) {
+      return false;
+    }
+
+    auto& s = slots_[index];
+    tbb::spin_rw_mutex::scoped_lock lock{s.mutex, false};
+    if (not s.entry) {
+      return false;
+    }
+    std::invoke(std::forward<F>(f), *s.key, s.entry->get());
+    return true;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value>
+  template <typename T, std::invocable<Key const&, Value const&> F>
+    requires detail::key_with_support_function<Key, T>
+  bool
+  cache<Key, Value, dense_backend>::visit_for(T const& t, F&& f) const
+  {
+    std::optional<std::size_t> match;
+    for (std::size_t i = 0; i != traits::extent; ++i) {
+      auto& s = slots_[i];
+      tbb::spin_rw_mutex::scoped_lock lock{s.mutex, false};
+      if (not s.entry or not s.key->supports(t)) {
+        continue;
+      }
+      if (match) {
+        throw cet::exception("Data retrieval error.")
+          << "More than one key match.";
+      }
+      match = i;
+    }
+    if (not match) {
+      return false;
+    }
+
+    // The slot may have been emptied since it was matched.
+    auto& s = slots_[*match];
+    tbb::spin_rw_mutex::scoped_lock lock{s.mutex, false};
+    if (not s.entry or not s.key->supports(t)) {
+      return false;
+    }
+    std::invoke(std::forward<F>(f), *s.key, s.entry->get());
+    return true;
+  }
+
+  template <detail::hashable_cache_key Key, typename Value>
+  template <typename T>
+    requires std::convertible_to<T, Value>
+  cache_handle<Key, Value>
+  cache<Key, Value, dense_backend>::emplace(Key const& key, T&& value)
+  {
+    auto const index = index_for(key);
+    if (index >= traits::extent) {
+      throw cet::exception("Cache insertion error.")
+        << "The index " << index
+        << " of the provided key is outside of the dense key domain [0, "
+        << traits::extent << ").";
+    }
+
+    auto& s = slots_[index];
+    tbb::spin_rw_mutex::scoped_lock lock{s.mutex, true};
+    if (s.entry) {
+      // Entry already exists; return cached entry.
+      return handle{&*s.key, &*s.entry};
+    }
+
+    s.entry.emplace(std::forward<T>(value),
+                    detail::make_counter(next_sequence_number_.fetch_add(1)));
+    s.key.emplace(key);
+    ++size_;
+    return handle{&*s.key, &*s.entry};
+  }
+
+  template <detail::hashable_cache_key Key, typename Value>
+  void
+  cache<Key, Value, dense_backend>::drop_unused()
+  {
+    drop_unused_but_last(0);
+  }
+
+  template <detail::hashable_cache_key Key, typename Value>
+  void
+  cache<Key, Value, dense_backend>::drop_unused_but_last(std::size_t const keep_last)
+  {
+    std::vector<std::pair<std::size_t, std::size_t>> entries_to_drop;
+    for (std::size_t i = 0; i != traits::extent; ++i) {
+      auto& s = slots_[i];
+      tbb::spin_rw_mutex::scoped_lock lock{s.mutex, false};
+      if (s.entry and s.entry->reference_count() == 0u) {
+        entries_to_drop.emplace_back(s.entry->sequence_number(), i);
+      }
+    }
+
+    // Sort in reverse-chronological order (according to sequence number).
+    std::sort(begin(entries_to_drop),
+              end(entries_to_drop),
+              [](auto const& a, auto const& b) { return a.first > b.first; });
+
+    if (std::size(entries_to_drop) <= keep_last) {
+      return;
+    }
+
+    auto const erase_begin = cbegin(entries_to_drop) + keep_last;
+    auto const erase_end = cend(entries_to_drop);
+    for (auto it = erase_begin; it != erase_end; ++it) {
+      auto& s = slots_[it->second];
+      tbb::spin_rw_mutex::scoped_lock lock{s.mutex, true};
+      // The slot may have been refilled, or the entry referenced
+      // again, since it was collected above.
+      if (not s.entry or s.entry->sequence_number() != it->first or
+          s.entry->reference_count() != 0u) {
+        continue;
+      }
+      s.entry.reset();
+      s.key.reset();
+      --size_;
+    }
+  }
+
+  template <detail::hashable_cache_key Key, typename Value>
+  void
+  cache<Key, Value, dense_backend>::shrink_to_fit()
+  {
+    HEP_CONCURRENCY_ASSERT_ONLY_ONE_THREAD();
+    // The slot array has a fixed size; only the unused entries can be
+    // released.
+    drop_unused();
+  }
+}
+
+#endif /* hep_concurrency_detail_dense_cache_h */
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,137 @@
+#ifndef hep_concurrency_detail_expiry_index_h
+#define hep_concurrency_detail_expiry_index_h
+
+// ===================================================================
+// The expiry_index class template keeps the keys of a cache ordered
+// by the (exclusive) upper bound of the values they can support.  It
+// is used by cache::advance_watermark(...) to find the keys that can
+// no longer be matched without scanning the entire cache.
+//
+// The index is maintained only once it has been enabled; until then,
+// and for key types that do not provide an upper_bound() function,
+// it is empty and all operations are no-ops.
+//
+// N.B. This is not intended to be user-facing.
+// ===================================================================
+
+#include <concepts>
+#include <map>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace hep::concurrency::detail {
+
+  template <typename Key>
+  concept key_with_upper_bound = requires(Key const& key) {
+                                   {
+                                     key.upper_bound()
+                                     } -> std::totally_ordered;
+                                 };
+
+  template <typename Key>
+  class expiry_index {
+  public:
+    void
+    insert(Key const&)
+    {}
+    void
+    erase(Key const&)
+    {}
+    void
+    clear()
+    {}
+  };
+
+  template <key_with_upper_bound Key>
+  class expiry_index<Key> {
+  public:
+    using bound_type =
+      std::remove_cvref_t<decltype(std::declval<Key const&>().upper_bound())>;
+
+    // Thread-unsafe
+    void
+    enable() noexcept
+    {
+      enabled_ = true;
+    }
+
+    bool
+    enabled() const noexcept
+    {
+      return enabled_;
+    }
+
+    // The key must not already be in the index.
+    void
+    insert(Key const& key)
+    {
+      if (not enabled_) {
+        return;
+      }
+      std::lock_guard lock{mutex_};
+      keys_.emplace(key.upper_bound(), key);
+    }
+
+    void
+    erase(Key const& key)
+    {
+      if (not enabled_) {
+        return;
+      }
+      std::lock_guard lock{mutex_};
+      auto [it, end] = keys_.equal_range(key.upper_bound());
+      for (; it != end; ++it) {
+        if (it->second == key) {
+          keys_.erase(it);
+          return;
+        }
+      }
+    }
+
+    // Calls remove(key) for each key whose upper bound does not exceed
+    // the watermark.  Keys are not dropped from the index here; remove
+    // is expected to call erase(key) for each key it removes from the
+    // cache.  The index lock is not held while remove is called, so
+    // remove may acquire other locks.
+    template <typename T, typename F>
+    void
+    expire(T const& watermark, F remove)
+    {
+      if (not enabled_) {
+        return;
+      }
+      std::vector<Key> expired;
+      {
+        std::lock_guard lock{mutex_};
+        auto const end = keys_.upper_bound(watermark);
+        for (auto it = keys_.begin(); it != end; ++it) {
+          expired.push_back(it->second);
+        }
+      }
+      for (auto const& key : expired) {
+        remove(key);
+      }
+    }
+
+    // Thread-unsafe
+    void
+    clear()
+    {
+      keys_.clear();
+    }
+
+  private:
+    using map_t = std::multimap<bound_type, Key>;
+    bool enabled_{false};
+    std::mutex mutex_;
+    map_t keys_;
+  };
+}
+
+#endif /* hep_concurrency_detail_expiry_index_h */
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,86 @@
+#ifndef hep_concurrency_detail_front_cache_h
+#define hep_concurrency_detail_front_cache_h
+
+// ===================================================================
+// The front_cache class template is a small, direct-mapped table of
+// recently looked-up cache entries.  One front_cache object is owned
+// by each thread that accesses a cache (see
+// cache::enable_front_cache()), so reading and writing its slots
+// requires no synchronization.
+//
+// A slot is trustworthy only if the eviction epoch recorded with it
+// still matches the cache's current epoch.  The protocol for using a
+// slot is described in cache.h.
+//
+// N.B. This is not intended to be user-facing.
+// ===================================================================
+
+#include "hep_concurrency/detail/cache_entry.h"
+#include "hep_concurrency/detail/cache_hashers.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+namespace hep::concurrency::detail {
+
+  template <typename Key, typename Value>
+  class front_cache {
+  public:
+    struct slot {
+      std::optional<Key> key{};
+      Key const* key_address{nullptr};
+      Value const* value{nullptr};
+      entry_count_ptr counter{};
+      std::size_t epoch{};
+    };
+
+    explicit front_cache(std::size_t const n_slots)
+      : slots_(std::bit_ceil(std::max(n_slots, std::size_t{1})))
+    {}
+
+    slot&
+    slot_for(Key const& key)
+    {
+      auto const hash = collection_hasher<Key>::hash(key);
+      return slots_[hash & (std::size(slots_) - 1)];
+    }
+
+    // Returns the slot only if it refers to the given key.
+    slot*
+    find(Key const& key)
+    {
+      auto& s = slot_for(key);
+      if (s.key and collection_hasher<Key>::equal(*s.key, key)) {
+        return &s;
+      }
+      return nullptr;
+    }
+
+    void
+    record(Key const& key,
+           Key const* key_address,
+           Value const* value,
+           entry_count_ptr counter,
+           std::size_t const epoch)
+    {
+      auto& s = slot_for(key);
+      s.key = key;
+      s.key_address = key_address;
+      s.value = value;
+      s.counter = std::move(counter);
+      s.epoch = epoch;
+    }
+
+  private:
+    std::vector<slot> slots_;
+  };
+}
+
+#endif /* hep_concurrency_detail_front_cache_h */
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,166 @@
+#ifndef hep_concurrency_detail_negative_cache_h
+#define hep_concurrency_detail_negative_cache_h
+
+// ===================================================================
+// The negative_cache class remembers values for which no cache key
+// was found by cache::entry_for(...).  Since entry_for(...) is a
+// function template, misses for values of different types are kept
+// in separate tables, created on first use.
+//
+// Each table holds the misses established during one insertion
+// generation of the cache.  A miss is valid only while the generation
+// is unchanged, i.e. until the next entry is inserted into the cache.
+// The first miss recorded for a later generation therefore replaces
+// the table with an empty one, so that misses of past generations
+// never occupy the capacity.
+//
+// N.B. This is not intended to be user-facing.
+// ===================================================================
+
+#include "hep_concurrency/detail/cache_hashers.h"
+#include "tbb/concurrent_hash_map.h"
+
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <typeindex>
+#include <typeinfo>
+
+namespace hep::concurrency::detail {
+
+  template <typename T>
+  concept negative_cacheable =
+    hashable_cache_key<T> and std::equality_comparable<T> and
+    std::copy_constructible<T>;
+
+  class negative_cache {
+  public:
+    struct miss {
+      std::size_t generation;
+      bool confirmed; // By the user, via cache::mark_absent(...)
+    };
+
+    // Thread-unsafe: to be called only before concurrent use.
+    void
+    set_capacity(std::size_t const n) noexcept
+    {
+      capacity_ = n;
+    }
+
+    bool
+    enabled() const noexcept
+    {
+      return capacity_ != 0ull;
+    }
+
+    // Returns the recorded miss if it is valid for the generation.
+    template <negative_cacheable T>
+    std::optional<miss>
+    find(T const& t, std::size_t const generation) const
+    {
+      auto* misses = table_for<T>();
+      if (misses == nullptr) {
+        return std::nullopt;
+      }
+      auto const current = misses->current.load();
+      if (current == nullptr or current->generation != generation) {
+        return std::nullopt;
+      }
+      typename table<T>::map_t::const_accessor access_token;
+      if (not current->map.find(access_token, t)) {
+        return std::nullopt;
+      }
+      return miss{generation, access_token->second};
+    }
+
+    template <negative_cacheable T>
+    void
+    insert(T const& t, miss const m)
+    {
+      auto* misses = make_table_for<T>();
+      auto current = misses->current.load();
+      while (current == nullptr or current->generation < m.generation) {
+        auto next = std::make_shared<typename table<T>::generation_t>(
+          m.generation);
+        if (misses->current.compare_exchange_weak(current, next)) {
+          current = std::move(next);
+        }
+      }
+      // A miss established before the latest insertion is stale.
+      if (current->generation != m.generation or
+          current->map.size() >= capacity_) {
+        return;
+      }
+      typename table<T>::map_t::accessor access_token;
+      current->map.insert(access_token, t);
+      if (m.confirmed) {
+        access_token->second = true;
+      }
+    }
+
+    // Thread-unsafe
+    void
+    clear()
+    {
+      tables_.clear();
+    }
+
+  private:
+    struct table_base {
+      virtual ~table_base() = default;
+    };
+
+    template <typename T>
+    struct table : table_base {
+      // Maps each value to whether the miss has been confirmed.
+      using map_t = tbb::concurrent_hash_map<T, bool, collection_hasher<T>>;
+      struct generation_t {
+        explicit generation_t(std::size_t const g) : generation{g} {}
+        std::size_t const generation;
+        map_t map;
+      };
+      std::atomic<std::shared_ptr<generation_t>> current{};
+    };
+
+    using tables_t =
+      tbb::concurrent_hash_map<std::type_index,
+                               std::unique_ptr<table_base>,
+                               collection_hasher<std::type_index>>;
+
+    template <typename T>
+    table<T>*
+    table_for() const
+    {
+      typename tables_t::const_accessor access_token;
+      if (not tables_.find(access_token, std::type_index{typeid(T)})) {
+        return nullptr;
+      }
+      return static_cast<table<T>*>(access_token->second.get());
+    }
+
+    template <typename T>
+    table<T>*
+    make_table_for()
+    {
+      if (auto* result = table_for<T>()) {
+        return result;
+      }
+      typename tables_t::accessor access_token;
+      if (tables_.insert(access_token, std::type_index{typeid(T)})) {
+        access_token->second = std::make_unique<table<T>>();
+      }
+      return static_cast<table<T>*>(access_token->second.get());
+    }
+
+    std::size_t capacity_{0ull};
+    tables_t tables_;
+  };
+}
+
+#endif /* hep_concurrency_detail_negative_cache_h */
+
+// Local Variables:
+// mode: c++
+// End:
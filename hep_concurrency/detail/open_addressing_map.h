@@ -0,0 +1,615 @@
+#ifndef hep_concurrency_detail_open_addressing_map_h
+#define hep_concurrency_detail_open_addressing_map_h
+
+// ===================================================================
+// The open_addressing_map class template is a concurrent hash map
+// with the accessor interface of tbb::concurrent_hash_map (the
+// subset used by the cache).  It is the map used by the
+// open_addressing_backend (see cache_backends.h).
+//
+// Elements are kept in a single, linearly-probed array of slots.
+// Each slot holds the element's hash value, a pointer to the
+// separately allocated element, and a reader-writer spin lock.
+// Because elements are never moved, their addresses remain stable
+// (as they are for tbb::concurrent_hash_map).
+//
+//   - Lookups do not acquire any lock other than that of the slot
+//     holding the key.  Slots whose hash values differ from the key's
+//     are skipped without being locked.
+//
+//   - Insertions are serialized by one mutex, which is not held while
+//     waiting for the lock of an existing element.
+//
+//   - Erasure leaves a tombstone, which may be reused by a later
+//     insertion.  While holding the insertion mutex, erasure then
+//     moves later elements of the cluster back into tombstones on
+//     their probe sequences, and empties the tombstones that no
+//     element's probe sequence passes.  Elements whose slots are
+//     locked are not moved; tombstones left behind are removed by
+//     rehash().  A lookup that misses while an element is being
+//     moved is retried.
+//
+// The number of slots is fixed during concurrent use.  Inserting
+// into a map whose slots (including tombstones) are 7/8 full throws
+// an exception; rehash(n), which is not thread-safe, must be called
+// beforehand to accommodate n elements.  As erasure removes
+// tombstones, repeated insertion and erasure do not fill the map.
+//
+// N.B. This is not intended to be user-facing.
+// ===================================================================
+
+#include "cetlib_except/exception.h"
+#include "tbb/spin_mutex.h"
+#include "tbb/spin_rw_mutex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <tuple>
+#include <utility>
+
+namespace hep::concurrency::detail {
+
+  enum class open_addressing_slot_state : std::uint8_t { empty, full, deleted };
+
+  // A slot of an open_addressing_map whose elements are of type
+  // Element.  Its size does not depend on Element.
+  template <typename Element>
+  struct open_addressing_slot {
+    tbb::spin_rw_mutex mutex;
+    std::atomic<open_addressing_slot_state> state{
+      open_addressing_slot_state::empty};
+    std::atomic<std::size_t> hash{};
+    std::atomic<Element*> element{nullptr};
+  };
+
+  template <typename Key,
+            typename T,
+            typename HashCompare,
+            std::size_t InitialSlots = 1024>
+  class open_addressing_map {
+  public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<Key const, T>;
+    using size_type = std::size_t;
+
+  private:
+    using slot_state = open_addressing_slot_state;
+    using slot = open_addressing_slot<value_type>;
+
+  public:
+
+    class const_accessor;
+    class accessor;
+    class iterator;
+
+    explicit open_addressing_map(size_type const n_slots = InitialSlots)
+      : slots_{std::make_unique<slot[]>(std::bit_ceil(n_slots))}
+      , capacity_{std::bit_ceil(n_slots)}
+    {}
+    ~open_addressing_map() { clear(); }
+
+    open_addressing_map(open_addressing_map const&) = delete;
+    open_addressing_map& operator=(open_addressing_map const&) = delete;
+
+    // Concurrent operations
+    bool
+    find(const_accessor& result, Key const& key) const
+    {
+      return lookup(result, key, false);
+    }
+    bool
+    find(accessor& result, Key const& key)
+    {
+      return lookup(result, key, true);
+    }
+    bool insert(accessor& result, Key const& key);
+    bool erase(accessor& item);
+
+    size_type
+    size() const noexcept
+    {
+      return size_;
+    }
+    bool
+    empty() const noexcept
+    {
+      return size_ == 0ull;
+    }
+    size_type
+    bucket_count() const noexcept
+    {
+      return capacity_;
+    }
+
+    // Thread-unsafe
+    void rehash(size_type n = 0);
+    void clear();
+    iterator begin();
+    iterator end();
+
+  private:
+    static std::size_t
+    hash_of(Key const& key)
+    {
+      return HashCompare::hash(key);
+    }
+
+    // Hash values (e.g. of integers) need not be well distributed, so
+    // they are mixed before selecting the first slot of the probe.
+    size_type
+    home(std::size_t const hash) const noexcept
+    {
+      auto const mixed = hash * 0x9e3779b97f4a7c15ull;
+      return (mixed ^ (mixed >> 32)) & (capacity_ - 1);
+    }
+
+    size_type
+    max_used() const noexcept
+    {
+      return capacity_ - capacity_ / 8;
+    }
+
+    // Distance from slot 'from' to slot 'to' along a probe sequence
+    size_type
+    distance(size_type const from, size_type const to) const noexcept
+    {
+      return (to - from) & (capacity_ - 1);
+    }
+
+    bool lookup(const_accessor& result, Key const& key, bool write) const;
+    bool probe(const_accessor& result,
+               Key const& key,
+               std::size_t hash,
+               bool write) const;
+    bool relocate(slot& from, slot& to);
+    void compact(size_type hole);
+
+    std::unique_ptr<slot[]> slots_;
+    size_type capacity_;
+    std::atomic<size_type> size_{0ull};
+    size_type used_{0ull}; // Full slots and tombstones
+    tbb::spin_mutex insert_mutex_;
+    // Odd while an element is being moved to another slot
+    std::atomic<size_type> relocations_{0ull};
+  };
+
+  // -------------------------------------------------------------------
+  template <typename Key, typename T, typename HashCompare, std::size_t N>
+  class open_addressing_map<Key, T, HashCompare, N>::const_accessor {
+  public:
+    const_accessor() = default;
+    ~const_accessor() { release(); }
+
+    const_accessor(const_accessor const&) = delete;
+    const_accessor& operator=(const_accessor const&) = delete;
+
+    bool
+    empty() const noexcept
+    {
+      return element_ == nullptr;
+    }
+    void
+    release()
+    {
+      if (element_ != nullptr) {
+        lock_.release();
+        element_ = nullptr;
+      }
+    }
+
+    value_type const&
+    operator*() const
+    {
+      return *element_;
+    }
+    value_type const*
+    operator->() const
+    {
+      return element_;
+    }
+
+  protected:
+    friend class open_addressing_map;
+    tbb::spin_rw_mutex::scoped_lock lock_{};
+    value_type* element_{nullptr};
+    slot* slot_{nullptr};
+  };
+
+  template <typename Key, typename T, typename HashCompare, std::size_t N>
+  class open_addressing_map<Key, T, HashCompare, N>::accessor
+    : public const_accessor {
+  public:
+    value_type&
+    operator*() const
+    {
+      return *this->element_;
+    }
+    value_type*
+    operator->() const
+    {
+      return this->element_;
+    }
+  };
+
+  // Iterates over the elements; thread-unsafe.
+  template <typename Key, typename T, typename HashCompare, std::size_t N>
+  class open_addressing_map<Key, T, HashCompare, N>::iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = open_addressing_map::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type*;
+    using reference = value_type&;
+
+    iterator() = default;
+
+    reference
+    operator*() const
+    {
+      return *current_->element;
+    }
+    pointer
+    operator->() const
+    {
+      return current_->element;
+    }
+    iterator&
+    operator++()
+    {
+      ++current_;
+      skip_unused();
+      return *this;
+    }
+    iterator
+    operator++(int)
+    {
+      auto result = *this;
+      ++*this;
+      return result;
+    }
+    bool operator==(iterator const&) const = default;
+
+  private:
+    friend class open_addressing_map;
+    iterator(slot* current, slot* end) : current_{current}, end_{end}
+    {
+      skip_unused();
+    }
+
+    void
+    skip_unused()
+    {
+      while (current_ != end_ and current_->state != slot_state::full) {
+        ++current_;
+      }
+    }
+
+    slot* current_{nullptr};
+    slot* end_{nullptr};
+  };
+
+  // -------------------------------------------------------------------
+  // Implementation
+
+  template <typename Key, typename T, typename HashCompare, std::size_t N>
+  bool
+  open_addressing_map<Key, T, HashCompare, N>::lookup(
+    const_accessor& result,
+    Key const& key,
+    bool const write) const
+  {
+    result.release();
+    auto const hash = hash_of(key);
+    for (;;) {
+      // An element being moved may be missed by the probe, but only
+      // while the relocation count is odd or changes.
+      auto const relocations = relocations_.load();
+      if (probe(result, key, hash, write)) {
+        return true;
+      }
+      if (relocations % 2 == 0ull and relocations_.load() == relocations) {
+        return false;
+      }
+    }
+  }
+
+  template <typename Key, typename T, typename HashCompare, std::size_t N>
+  bool
+  open_addressing_map<Key, T, HashCompare, N>::probe(
+    const_accessor& result,
+    Key const& key,
+    std::size_t const hash,
+    bool const write) const
+  {
+    auto const mask = capacity_ - 1;
+    auto const first = home(hash);
+    for (size_type i = 0; i != capacity_; ++i) {
+      auto& s = slots_[(first + i) & mask];
+      auto const state = s.state.load(std::memory_order_acquire);
+      if (state == slot_state::empty) {
+        return false;
+      }
+      if (state == slot_state::deleted or s.hash.load() != hash) {
+        continue;
+      }
+
+      // The slot may have been emptied or refilled in the meantime.
+      result.lock_.acquire(s.mutex, write);
+      if (s.state.load() == slot_state::full and s.hash.load() == hash and
+          HashCompare::equal(s.element.load()->first, key)) {
+        result.element_ = s.element.load();
+        result.slot_ = &s;
+        return true;
+      }
+      result.lock_.release();
+    }
+    return false;
+  }
+
+  template <typename Key, typename T, typename HashCompare, std::size_t N>
+  bool
+  open_addressing_map<Key, T, HashCompare, N>::insert(accessor& result,
+                                                      Key const& key)
+  {
+    result.release();
+    auto const hash = hash_of(key);
+    auto const mask = capacity_ - 1;
+    auto const first = home(hash);
+    for (;;) {
+      std::unique_lock insert_lock{insert_mutex_};
+      slot* free_slot{nullptr};
+      slot* existing{nullptr};
+      for (size_type i = 0; i != capacity_; ++i) {
+        auto& s = slots_[(first + i) & mask];
+        auto const state = s.state.load(std::memory_order_acquire);
+        if (state == slot_state::empty) {
+          if (free_slot == nullptr) {
+            free_slot = &s;
+          }
+          break;
+        }
+        if (state == slot_state::deleted) {
+          if (free_slot == nullptr) {
+            free_slot = &s;
+          }
+          continue;
+        }
+        if (s.hash.load() != hash) {
+          continue;
+        }
+
+        // The element must be locked to be compared, as it may be
+        // erased concurrently.  Do not wait for the lock while the
+        // insertion mutex is held.
+        tbb::spin_rw_mutex::scoped_lock probe;
+        if (not probe.try_acquire(s.mutex, false)) {
+          existing = &s; // Possibly; verified below
+          break;
+        }
+        if (s.state.load() == slot_state::full and
+            HashCompare::equal(s.element.load()->first, key)) {
+          existing = &s;
+          break;
+        }
+      }
+
+      if (existing != nullptr) {
+        insert_lock.unlock();
+        result.lock_.acquire(existing->mutex, true);
+        if (existing->state.load() == slot_state::full and
+            HashCompare::equal(existing->element.load()->first, key)) {
+          result.element_ = existing->element.load();
+          result.slot_ = existing;
+          return false;
+        }
+        // The element was erased, or (if the slot could not be
+        // inspected above) it has a different key; start over.
+        result.lock_.release();
+        continue;
+      }
+
+      if (free_slot == nullptr or
+          (free_slot->state.load() == slot_state::empty and
+           used_ + 1 > max_used())) {
+        throw cet::exception("Cache insertion error.")
+          << "The open-addressing map is full (" << capacity_
+          << " slots); reserve more space before concurrent use.";
+      }
+
+      // Readers never lock empty or deleted slots for long, as they
+      // find the state changed once the lock is acquired.
+      result.lock_.acquire(free_slot->mutex, true);
+      auto element = std::make_unique<value_type>(std::piecewise_construct,
+                                                  std::forward_as_tuple(key),
+                                                  std::forward_as_tuple());
+      if (free_slot->state.load() == slot_state::empty) {
+        ++used_;
+      }
+      free_slot->hash.store(hash);
+      free_slot->element.store(element.get());
+      free_slot->state.store(slot_state::full, std::memory_order_release);
+      ++size_;
+      result.element_ = element.release();
+      result.slot_ = free_slot;
+      return true;
+    }
+  }
+
+  template <typename Key, typename T, typename HashCompare, std::size_t N>
+  bool
+  open_addressing_map<Key, T, HashCompare, N>::erase(accessor& item)
+  {
+    if (item.empty()) {
+      return false;
+    }
+    // The write lock on the slot is held by the accessor.  Taking the
+    // insertion mutex while holding it cannot deadlock, as insert()
+    // waits only for the locks of empty and deleted slots while it
+    // holds the mutex.
+    auto* s = item.slot_;
+    std::unique_ptr<value_type> element; // Destroyed without the mutex
+    std::lock_guard insert_lock{insert_mutex_};
+    s->state.store(slot_state::deleted, std::memory_order_release);
+    element.reset(s->element.exchange(nullptr));
+    --size_;
+    item.release();
+
+    compact(static_cast<size_type>(s - slots_.get()));
+    return true;
+  }
+
+  template <typename Key, typename T, typename HashCompare, std::size_t N>
+  bool
+  open_addressing_map<Key, T, HashCompare, N>::relocate(slot& from, slot& to)
+  {
+    // Called with the insertion mutex held, so the locks are only
+    // tried: an accessor may hold that of 'from', and its owner may
+    // be waiting for the mutex to erase the element.
+    tbb::spin_rw_mutex::scoped_lock from_lock;
+    if (not from_lock.try_acquire(from.mutex, true)) {
+      return false;
+    }
+    tbb::spin_rw_mutex::scoped_lock to_lock;
+    if (not to_lock.try_acquire(to.mutex, true)) {
+      return false;
+    }
+    ++relocations_;
+    to.hash.store(from.hash.load());
+    to.element.store(from.element.exchange(nullptr));
+    to.state.store(slot_state::full, std::memory_order_release);
+    from.state.store(slot_state::deleted, std::memory_order_release);
+    ++relocations_;
+    return true;
+  }
+
+  template <typename Key, typename T, typename HashCompare, std::size_t N>
+  void
+  open_addressing_map<Key, T, HashCompare, N>::compact(size_type hole)
+  {
+    // Called with the insertion mutex held, just after the element
+    // in slot 'hole' has been erased.  Walk to the end of the
+    // cluster, moving each element into the earliest tombstone
+    // between its home slot and its current slot.
+    auto const mask = capacity_ - 1;
+    auto const erased = hole;
+    auto end = hole;
+    for (size_type n = 1;; ++n) {
+      if (n == capacity_) {
+        return; // No slot is empty
+      }
+      end = (end + 1) & mask;
+      auto& s = slots_[end];
+      auto const state = s.state.load();
+      if (state == slot_state::empty) {
+        break;
+      }
+      if (state == slot_state::deleted) {
+        continue;
+      }
+      auto const first = home(s.hash.load());
+      if (distance(first, hole) >= distance(first, end) or
+          not relocate(s, slots_[hole])) {
+        continue;
+      }
+      // The earliest tombstone is now at or after the vacated slot.
+      do {
+        hole = (hole + 1) & mask;
+      } while (slots_[hole].state.load() != slot_state::deleted);
+    }
+
+    auto begin = erased;
+    while (slots_[(begin - 1) & mask].state.load() != slot_state::empty) {
+      begin = (begin - 1) & mask;
+    }
+
+    // A lookup stops at the first empty slot, and the probe sequence
+    // of each element passes only non-empty slots.  A tombstone that
+    // lies on no element's probe sequence can therefore be emptied.
+    // Slots only change state while the mutex is held.
+    auto first_needed = distance(begin, end);
+    for (auto i = end; i != begin;) {
+      i = (i - 1) & mask;
+      auto& s = slots_[i];
+      if (s.state.load() == slot_state::full) {
+        first_needed =
+          std::min(first_needed, distance(begin, home(s.hash.load())));
+      }
+      else if (distance(begin, i) < first_needed) {
+        s.state.store(slot_state::empty, std::memory_order_release);
+        --used_;
+      }
+    }
+  }
+
+  template <typename Key, typename T, typename HashCompare, std::size_t N>
+  void
+  open_addressing_map<Key, T, HashCompare, N>::rehash(size_type const n)
+  {
+    auto const required = std::max<size_type>(n, size_) * 8 / 7 + 1;
+    auto const new_capacity = std::max(capacity_, std::bit_ceil(required));
+    auto old_slots =
+      std::exchange(slots_, std::make_unique<slot[]>(new_capacity));
+    auto const old_capacity = std::exchange(capacity_, new_capacity);
+    auto const mask = new_capacity - 1;
+    for (auto& s : std::span{old_slots.get(), old_capacity}) {
+      if (s.state != slot_state::full) {
+        continue;
+      }
+      auto const hash = s.hash.load();
+      auto const first = home(hash);
+      for (size_type i = 0;; ++i) {
+        auto& target = slots_[(first + i) & mask];
+        if (target.state == slot_state::empty) {
+          target.hash = hash;
+          target.element = s.element.load();
+          target.state = slot_state::full;
+          break;
+        }
+      }
+    }
+    used_ = size_;
+  }
+
+  template <typename Key, typename T, typename HashCompare, std::size_t N>
+  void
+  open_addressing_map<Key, T, HashCompare, N>::clear()
+  {
+    for (auto& s : std::span{slots_.get(), capacity_}) {
+      if (s.state == slot_state::full) {
+        delete s.element.load();
+      }
+      s.element = nullptr;
+      s.state = slot_state::empty;
+    }
+    size_ = 0ull;
+    used_ = 0ull;
+  }
+
+  template <typename Key, typename T, typename HashCompare, std::size_t N>
+  auto
+  open_addressing_map<Key, T, HashCompare, N>::begin() -> iterator
+  {
+    return {slots_.get(), slots_.get() + capacity_};
+  }
+
+  template <typename Key, typename T, typename HashCompare, std::size_t N>
+  auto
+  open_addressing_map<Key, T, HashCompare, N>::end() -> iterator
+  {
+    return {slots_.get() + capacity_, slots_.get() + capacity_};
+  }
+}
+
+#endif /* hep_concurrency_detail_open_addressing_map_h */
+
+// Local Variables:
+// mode: c++
+// End:
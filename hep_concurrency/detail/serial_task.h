@@ -0,0 +1,146 @@
+#ifndef hep_concurrency_detail_serial_task_h
+#define hep_concurrency_detail_serial_task_h
+
+// ===================================================================
+// A serial_task is a move-only, type-erased callable taking no
+// arguments, used by SerialTaskQueue to hold the tasks it has not yet
+// started.  Unlike std::function, it accepts move-only callables, and
+// a callable no larger than buffer_size bytes that can be moved
+// without throwing is stored in place, so that constructing a
+// serial_task from a typical lambda does not allocate.  Other
+// callables are stored on the heap.
+//
+// N.B. This is not intended to be user-facing.
+// ===================================================================
+
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace hep::concurrency::detail {
+
+  template <typename F>
+  concept serial_task_callable = std::invocable<std::decay_t<F>&> and
+                                 std::constructible_from<std::decay_t<F>, F>;
+
+  class serial_task {
+  public:
+    static constexpr std::size_t buffer_size{6 * sizeof(void*)};
+
+    template <typename F>
+    static constexpr bool stored_in_place =
+      sizeof(F) <= buffer_size and alignof(F) <= alignof(std::max_align_t) and
+      std::is_nothrow_move_constructible_v<F>;
+
+    serial_task() = default;
+
+    template <serial_task_callable F>
+      requires(not std::same_as<std::decay_t<F>, serial_task>)
+    serial_task(F&& func);
+
+    serial_task(serial_task&& other) noexcept
+      : ops_{std::exchange(other.ops_, nullptr)}
+    {
+      if (ops_) {
+        ops_->relocate(other.buffer_, buffer_);
+      }
+    }
+    serial_task&
+    operator=(serial_task&& other) noexcept
+    {
+      if (this != &other) {
+        reset();
+        ops_ = std::exchange(other.ops_, nullptr);
+        if (ops_) {
+          ops_->relocate(other.buffer_, buffer_);
+        }
+      }
+      return *this;
+    }
+    ~serial_task() { reset(); }
+
+    explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+    // Like std::function, a serial_task can be invoked through a
+    // const reference (as tbb::task_group requires), even though the
+    // stored callable may be mutable.
+    void
+    operator()() const
+    {
+      ops_->invoke(buffer_);
+    }
+
+    void
+    reset() noexcept
+    {
+      if (ops_) {
+        std::exchange(ops_, nullptr)->destroy(buffer_);
+      }
+    }
+
+  private:
+    struct operations {
+      void (*invoke)(std::byte*);
+      // Moves the callable from one buffer to the other, and destroys
+      // the moved-from callable.
+      void (*relocate)(std::byte* from, std::byte* to) noexcept;
+      void (*destroy)(std::byte*) noexcept;
+    };
+
+    template <typename F>
+    static F&
+    callable_(std::byte* buffer) noexcept
+    {
+      if constexpr (stored_in_place<F>) {
+        return *std::launder(reinterpret_cast<F*>(buffer));
+      } else {
+        return **std::launder(reinterpret_cast<F**>(buffer));
+      }
+    }
+
+    template <typename F>
+    static constexpr operations operations_for{
+      [](std::byte* buffer) { std::invoke(callable_<F>(buffer)); },
+      [](std::byte* from, std::byte* to) noexcept {
+        if constexpr (stored_in_place<F>) {
+          auto& func = callable_<F>(from);
+          ::new (to) F(std::move(func));
+          func.~F();
+        } else {
+          ::new (to) F*(&callable_<F>(from));
+        }
+      },
+      [](std::byte* buffer) noexcept {
+        if constexpr (stored_in_place<F>) {
+          callable_<F>(buffer).~F();
+        } else {
+          delete &callable_<F>(buffer);
+        }
+      }};
+
+    alignas(std::max_align_t) mutable std::byte buffer_[buffer_size];
+    operations const* ops_{nullptr};
+  };
+
+  template <serial_task_callable F>
+    requires(not std::same_as<std::decay_t<F>, serial_task>)
+  serial_task::serial_task(F&& func)
+  {
+    using callable_t = std::decay_t<F>;
+    if constexpr (stored_in_place<callable_t>) {
+      ::new (buffer_) callable_t(std::forward<F>(func));
+    } else {
+      ::new (buffer_) callable_t*(new callable_t(std::forward<F>(func)));
+    }
+    ops_ = &operations_for<callable_t>;
+  }
+}
+
+#endif /* hep_concurrency_detail_serial_task_h */
+
+// Local Variables:
+// mode: c++
+// End:
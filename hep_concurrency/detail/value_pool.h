@@ -0,0 +1,89 @@
+#ifndef hep_concurrency_detail_value_pool_h
+#define hep_concurrency_detail_value_pool_h
+
+// ===================================================================
+// The value_pool class template holds values that have been evicted
+// from a cache so that their storage (e.g. the buffer of a
+// std::vector) can be reused when a new entry is created.  The pool
+// is bounded; values offered to a full pool are destroyed as usual.
+//
+// N.B. This is not intended to be user-facing.
+// ===================================================================
+
+#include "tbb/concurrent_queue.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace hep::concurrency::detail {
+
+  template <typename T>
+  class value_pool {
+  public:
+    // Thread-unsafe: to be called only before concurrent use.
+    void
+    set_capacity(std::size_t const n) noexcept
+    {
+      capacity_ = n;
+    }
+
+    std::size_t
+    capacity() const noexcept
+    {
+      return capacity_;
+    }
+
+    std::size_t
+    size() const noexcept
+    {
+      return size_;
+    }
+
+    // Takes ownership of the value if there is room in the pool;
+    // otherwise the value is left untouched.
+    bool
+    give(std::unique_ptr<T>& value)
+    {
+      if (value == nullptr or capacity_ == 0ull) {
+        return false;
+      }
+      if (size_.fetch_add(1) >= capacity_) {
+        --size_;
+        return false;
+      }
+      values_.push(std::move(value));
+      return true;
+    }
+
+    // Returns a null pointer if no value is available.
+    std::unique_ptr<T>
+    take()
+    {
+      std::unique_ptr<T> result;
+      if (values_.try_pop(result)) {
+        --size_;
+      }
+      return result;
+    }
+
+    // Thread-unsafe
+    void
+    clear()
+    {
+      values_.clear();
+      size_ = 0ull;
+    }
+
+  private:
+    tbb::concurrent_queue<std::unique_ptr<T>> values_;
+    std::atomic<std::size_t> size_{0ull};
+    std::size_t capacity_{0ull};
+  };
+}
+
+#endif /* hep_concurrency_detail_value_pool_h */
+
+// Local Variables:
+// mode: c++
+// End:
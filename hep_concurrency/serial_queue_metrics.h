@@ -0,0 +1,253 @@
+#ifndef hep_concurrency_serial_queue_metrics_h
+#define hep_concurrency_serial_queue_metrics_h
+
+// ====================================================================
+// Metrics of a SerialTaskQueue, collected once they have been enabled
+// for the queue:
+//
+//   SerialTaskQueue queue{group};
+//   queue.enable_metrics("RootOutput");
+//   ...
+//   auto const m = queue.metrics();
+//   std::cout << m.name << ": 99% of the tasks waited less than "
+//             << m.wait_time.percentile(0.99).count() << " ns\n";
+//
+// The snapshot returned by metrics() holds:
+//
+// - depth and max_depth: the current and the largest number of tasks
+//   that have been pushed but not yet started,
+// - wait_time: the time from the push of each task to its start,
+// - run_time: the time each task took to execute,
+// - pause_time: the time from each first pause() to the matching
+//   last resume(),
+// - contention: the number of times a thread had to wait or retry
+//   because of another thread (a producer that had not finished
+//   linking its task, or a concurrent use of the node pool).
+//
+// Durations are counted in histograms with power-of-two bins of
+// nanoseconds.  Recording threads write to separate, cache-aligned
+// shards of the histograms (one per thread, for up to n_shards
+// threads), so they do not contend with each other; metrics() adds
+// up the shards and may be called at any time.
+// ====================================================================
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+namespace hep::concurrency {
+
+  struct duration_histogram {
+    using duration = std::chrono::nanoseconds;
+
+    // Bin i holds the durations d with 2^(i-1) ns <= d < 2^i ns; bin 0
+    // holds zero durations and the last bin anything longer.
+    static constexpr std::size_t n_bins{48u};
+
+    static constexpr std::size_t
+    bin(duration const d) noexcept
+    {
+      auto const ns =
+        static_cast<std::uint64_t>(std::max<duration::rep>(d.count(), 0));
+      return std::min<std::size_t>(std::bit_width(ns), n_bins - 1);
+    }
+
+    static constexpr duration
+    upper_bound(std::size_t const bin) noexcept
+    {
+      return duration{std::int64_t{1} << bin};
+    }
+
+    std::uint64_t
+    count() const noexcept
+    {
+      std::uint64_t result{};
+      for (auto const n : counts) {
+        result += n;
+      }
+      return result;
+    }
+
+    duration
+    mean() const noexcept
+    {
+      auto const n = count();
+      return n == 0ull ? duration{} : total / static_cast<duration::rep>(n);
+    }
+
+    // Upper bound of the bin holding the q-th quantile (0 <= q <= 1)
+    duration
+    percentile(double const q) const noexcept
+    {
+      auto const n = count();
+      if (n == 0ull) {
+        return duration{};
+      }
+      auto const rank = static_cast<std::uint64_t>(q * (n - 1));
+      std::uint64_t seen{};
+      for (std::size_t i{}; i != n_bins; ++i) {
+        seen += counts[i];
+        if (seen > rank) {
+          return upper_bound(i);
+        }
+      }
+      return upper_bound(n_bins - 1);
+    }
+
+    std::array<std::uint64_t, n_bins> counts{};
+    duration total{};
+  };
+
+  struct serial_queue_metrics {
+    std::string name;
+    std::size_t depth;
+    std::size_t max_depth;
+    duration_histogram wait_time;
+    duration_histogram run_time;
+    duration_histogram pause_time;
+    std::uint64_t contention;
+  };
+
+  namespace detail {
+
+    class serial_queue_recorder {
+    public:
+      using clock = std::chrono::steady_clock;
+      static constexpr std::size_t n_shards{16u};
+
+      explicit serial_queue_recorder(std::string name)
+        : name_{std::move(name)}
+      {}
+
+      void
+      pushed() noexcept
+      {
+        auto const depth = ++depth_;
+        auto max_depth = max_depth_.load(std::memory_order_relaxed);
+        while (depth > max_depth and
+               not max_depth_.compare_exchange_weak(
+                 max_depth, depth, std::memory_order_relaxed)) {}
+      }
+
+      void
+      started() noexcept
+      {
+        --depth_;
+      }
+
+      void
+      record_wait(clock::duration const d) noexcept
+      {
+        shard_().wait.record(d);
+      }
+
+      void
+      record_run(clock::duration const d) noexcept
+      {
+        shard_().run.record(d);
+      }
+
+      void
+      contended() noexcept
+      {
+        shard_().contention.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      void
+      paused() noexcept
+      {
+        paused_since_.store(clock::now().time_since_epoch().count());
+      }
+
+      void
+      resumed() noexcept
+      {
+        if (auto const since = paused_since_.exchange(0); since != 0) {
+          clock::time_point const start{clock::duration{since}};
+          shard_().pause.record(clock::now() - start);
+        }
+      }
+
+      serial_queue_metrics
+      snapshot() const
+      {
+        serial_queue_metrics result{name_,
+                                    depth_.load(),
+                                    max_depth_.load(),
+                                    {},
+                                    {},
+                                    {},
+                                    0ull};
+        for (auto const& s : shards_) {
+          s.wait.add_to(result.wait_time);
+          s.run.add_to(result.run_time);
+          s.pause.add_to(result.pause_time);
+          result.contention += s.contention.load(std::memory_order_relaxed);
+        }
+        return result;
+      }
+
+    private:
+      struct histogram {
+        void
+        record(clock::duration const d) noexcept
+        {
+          using std::chrono::nanoseconds;
+          auto const ns = std::chrono::duration_cast<nanoseconds>(d);
+          counts[duration_histogram::bin(ns)].fetch_add(
+            1, std::memory_order_relaxed);
+          total_ns.fetch_add(ns.count(), std::memory_order_relaxed);
+        }
+
+        void
+        add_to(duration_histogram& h) const noexcept
+        {
+          for (std::size_t i{}; i != duration_histogram::n_bins; ++i) {
+            h.counts[i] += counts[i].load(std::memory_order_relaxed);
+          }
+          h.total += std::chrono::nanoseconds{
+            total_ns.load(std::memory_order_relaxed)};
+        }
+
+        std::array<std::atomic<std::uint64_t>, duration_histogram::n_bins>
+          counts{};
+        std::atomic<std::int64_t> total_ns{};
+      };
+
+      struct alignas(64) shard {
+        histogram wait;
+        histogram run;
+        histogram pause;
+        std::atomic<std::uint64_t> contention{};
+      };
+
+      // Threads are assigned shards in the order in which they first
+      // record a measurement, for any queue.
+      shard&
+      shard_() noexcept
+      {
+        static std::atomic<std::size_t> n_threads{};
+        thread_local std::size_t const index{n_threads++ % n_shards};
+        return shards_[index];
+      }
+
+      std::string const name_;
+      std::atomic<std::size_t> depth_{};
+      std::atomic<std::size_t> max_depth_{};
+      std::atomic<clock::rep> paused_since_{};
+      std::array<shard, n_shards> shards_{};
+    };
+  }
+}
+
+#endif /* hep_concurrency_serial_queue_metrics_h */
+
+// Local Variables:
+// mode: c++
+// End:
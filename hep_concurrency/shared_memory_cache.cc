@@ -0,0 +1,667 @@
+// vim: set sw=2 expandtab :
+#include "hep_concurrency/shared_memory_cache.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+// The segment consists of a header, the index slots, and the data
+// area, each aligned to 64 bytes.  All state shared between processes
+// is held in lock-free atomics, which are address-free and can
+// therefore be used from different mappings of the segment.
+
+namespace {
+  constexpr std::uint64_t segment_magic{0x31736d636e6f6368}; // "hconcms1"
+  constexpr std::uint32_t segment_version{3u};
+  constexpr std::size_t block_alignment{64ull};
+  constexpr unsigned min_block_shift{6u};
+  constexpr std::size_t n_size_classes{34ull};
+  constexpr std::uint32_t dead{~std::uint32_t{}};
+
+  // A free-list head holds a tag, to avoid the ABA problem, and the
+  // offset + 1 of the first free block (0 if the list is empty).
+  constexpr unsigned link_bits{40u};
+  constexpr std::uint64_t link_mask{(std::uint64_t{1} << link_bits) - 1};
+  constexpr std::size_t max_data_bytes{link_mask - 1};
+
+  constexpr auto open_timeout = std::chrono::seconds{30};
+  constexpr auto owner_check_interval = std::chrono::milliseconds{10};
+
+  enum slot_state : std::uint32_t { empty, claimed, loading, ready, dropped };
+
+  static_assert(std::atomic<std::uint32_t>::is_always_lock_free and
+                std::atomic<std::uint64_t>::is_always_lock_free);
+
+  constexpr std::size_t
+  round_up(std::size_t const n, std::size_t const alignment)
+  {
+    return (n + alignment - 1) / alignment * alignment;
+  }
+
+  std::size_t
+  block_size(std::size_t const bytes)
+  {
+    return std::max(std::bit_ceil(bytes), block_alignment);
+  }
+
+  std::size_t
+  size_class(std::size_t const block)
+  {
+    return static_cast<std::size_t>(std::countr_zero(block)) -
+           min_block_shift;
+  }
+
+  // FNV-1a, followed by a finalizer so that the low bits used to
+  // select a slot depend on all bytes of the key.
+  std::uint64_t
+  hash_bytes(void const* p, std::size_t const n)
+  {
+    auto const* bytes = static_cast<unsigned char const*>(p);
+    std::uint64_t h{0xcbf29ce484222325};
+    for (std::size_t i{}; i != n; ++i) {
+      h = (h ^ bytes[i]) * 0x100000001b3;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    return h;
+  }
+
+  [[noreturn]] void
+  throw_error(std::string const& name, std::string const& what)
+  {
+    throw cet::exception("Shared memory cache error.")
+      << "Segment '" << name << "': " << what << '\n';
+  }
+
+  template <typename Predicate>
+  void
+  wait_until(std::string const& name,
+             Predicate ready,
+             std::string const& what = "initialization")
+  {
+    auto const deadline = std::chrono::steady_clock::now() + open_timeout;
+    while (not ready()) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        throw_error(name, "timed out waiting for " + what);
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  // A process that has exited but has not yet been reaped by its
+  // parent is still considered alive.
+  bool
+  is_dead(pid_t const pid)
+  {
+    return pid > 0 and ::kill(pid, 0) == -1 and errno == ESRCH;
+  }
+
+  // Holds the segment's claim lock, which records the PID of its
+  // holder; a lock held by a terminated process is taken over.
+  class claim_guard {
+  public:
+    explicit claim_guard(std::atomic<std::int32_t>& owner) : owner_{owner}
+    {
+      auto next_check = std::chrono::steady_clock::now();
+      for (;;) {
+        auto holder = 0;
+        if (owner_.compare_exchange_weak(holder, ::getpid())) {
+          return;
+        }
+        if (auto const now = std::chrono::steady_clock::now();
+            now >= next_check) {
+          next_check = now + owner_check_interval;
+          if (is_dead(holder) and
+              owner_.compare_exchange_strong(holder, ::getpid())) {
+            return;
+          }
+        }
+        std::this_thread::yield();
+      }
+    }
+    ~claim_guard() { owner_.store(0); }
+
+    claim_guard(claim_guard const&) = delete;
+    claim_guard& operator=(claim_guard const&) = delete;
+
+  private:
+    std::atomic<std::int32_t>& owner_;
+  };
+}
+
+namespace hep::concurrency::detail {
+
+  struct shared_memory_segment::segment_header {
+    std::atomic<std::uint64_t> magic; // Stored last by the creator
+    std::uint32_t version;
+    std::uint32_t key_size;
+    std::uint64_t element_size;
+    std::uint64_t max_entries;
+    std::uint64_t n_slots;
+    std::uint64_t data_bytes;
+    std::atomic<std::int32_t> claim_owner; // PID, or 0 if unlocked
+    std::atomic<std::uint64_t> n_reserved; // Slots neither empty nor dropped
+    std::atomic<std::uint64_t> n_entries;
+    std::atomic<std::uint64_t> data_top;
+    std::atomic<std::uint64_t> bytes_used;
+    std::array<std::atomic<std::uint64_t>, n_size_classes> free_lists;
+  };
+
+  // The key follows the slot header.  The hash, key, offset and
+  // n_elements members are written only while the slot is claimed,
+  // before its state is published with release semantics.  The owner
+  // is the process loading the key.
+  struct shared_memory_segment::slot_header {
+    std::atomic<std::uint32_t> state;
+    std::atomic<std::uint32_t> refcount;
+    std::atomic<std::int32_t> owner;
+    std::uint64_t hash;
+    std::uint64_t offset;
+    std::uint64_t n_elements;
+  };
+
+  shared_memory_segment::shared_memory_segment(
+    std::string const& name,
+    std::size_t const key_size,
+    std::size_t const element_size,
+    shared_memory_options const& options)
+    : name_{name}, key_size_{key_size}, element_size_{element_size}
+  {
+    if (options.data_bytes > max_data_bytes) {
+      throw_error(name, "the data area is too large");
+    }
+    auto const n_slots =
+      std::bit_ceil(std::max(2 * options.max_entries, std::size_t{16}));
+    slot_size_ = round_up(sizeof(slot_header) + key_size, 16);
+    slots_offset_ = round_up(sizeof(segment_header), block_alignment);
+    data_offset_ =
+      slots_offset_ + round_up(n_slots * slot_size_, block_alignment);
+    mapped_bytes_ =
+      data_offset_ + round_up(options.data_bytes, block_alignment);
+
+    bool creator{true};
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1 and errno == EEXIST) {
+      creator = false;
+      fd = ::shm_open(name.c_str(), O_RDWR, 0);
+    }
+    if (fd == -1) {
+      throw_error(name, std::strerror(errno));
+    }
+
+    try {
+      if (creator) {
+        if (::ftruncate(fd, static_cast<off_t>(mapped_bytes_)) == -1) {
+          throw_error(name, std::strerror(errno));
+        }
+      }
+      else {
+        // The creator may not have sized the segment yet.
+        struct stat st {};
+        wait_until(name, [fd, &st] {
+          return ::fstat(fd, &st) == 0 and st.st_size != 0;
+        });
+        if (static_cast<std::size_t>(st.st_size) != mapped_bytes_) {
+          throw_error(name, "the segment was created with different options");
+        }
+      }
+      auto* p = ::mmap(
+        nullptr, mapped_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED) {
+        throw_error(name, std::strerror(errno));
+      }
+      base_ = static_cast<std::byte*>(p);
+    }
+    catch (...) {
+      ::close(fd);
+      if (creator) {
+        ::shm_unlink(name.c_str());
+      }
+      throw;
+    }
+    ::close(fd);
+
+    if (creator) {
+      initialize_(options, n_slots);
+      return;
+    }
+    try {
+      validate_(name, options, n_slots);
+    }
+    catch (...) {
+      ::munmap(base_, mapped_bytes_);
+      throw;
+    }
+  }
+
+  shared_memory_segment::~shared_memory_segment()
+  {
+    ::munmap(base_, mapped_bytes_);
+  }
+
+  bool
+  shared_memory_segment::remove(std::string const& name)
+  {
+    return ::shm_unlink(name.c_str()) == 0;
+  }
+
+  void
+  shared_memory_segment::initialize_(shared_memory_options const& options,
+                                     std::size_t const n_slots)
+  {
+    // The segment is zero-filled; the objects are created explicitly
+    // nonetheless.
+    auto* header = new (base_) segment_header{};
+    header->version = segment_version;
+    header->key_size = static_cast<std::uint32_t>(key_size_);
+    header->element_size = element_size_;
+    header->max_entries = options.max_entries;
+    header->n_slots = n_slots;
+    header->data_bytes = mapped_bytes_ - data_offset_;
+    for (std::size_t i{}; i != n_slots; ++i) {
+      new (base_ + slots_offset_ + i * slot_size_) slot_header{};
+    }
+    header->magic.store(segment_magic, std::memory_order_release);
+  }
+
+  void
+  shared_memory_segment::validate_(std::string const& name,
+                                   shared_memory_options const& options,
+                                   std::size_t const n_slots) const
+  {
+    auto const& header = header_();
+    wait_until(name, [&header] {
+      return header.magic.load(std::memory_order_acquire) == segment_magic;
+    });
+    if (header.version != segment_version) {
+      throw_error(name, "the segment has an incompatible version");
+    }
+    if (header.key_size != key_size_ or header.element_size != element_size_) {
+      throw_error(name, "the segment holds keys or values of another type");
+    }
+    if (header.max_entries != options.max_entries or
+        header.n_slots != n_slots) {
+      throw_error(name, "the segment was created with different options");
+    }
+  }
+
+  auto
+  shared_memory_segment::header_() const noexcept -> segment_header&
+  {
+    return *std::launder(reinterpret_cast<segment_header*>(base_));
+  }
+
+  auto
+  shared_memory_segment::slot_(std::size_t const i) const noexcept
+    -> slot_header&
+  {
+    return *std::launder(
+      reinterpret_cast<slot_header*>(base_ + slots_offset_ + i * slot_size_));
+  }
+
+  std::byte*
+  shared_memory_segment::data_base_() const noexcept
+  {
+    return base_ + data_offset_;
+  }
+
+  void const*
+  shared_memory_segment::key(std::size_t const i) const noexcept
+  {
+    return reinterpret_cast<std::byte const*>(&slot_(i)) +
+           sizeof(slot_header);
+  }
+
+  std::byte const*
+  shared_memory_segment::data(std::size_t const i) const noexcept
+  {
+    return data_base_() + slot_(i).offset;
+  }
+
+  std::size_t
+  shared_memory_segment::n_elements(std::size_t const i) const noexcept
+  {
+    return slot_(i).n_elements;
+  }
+
+  bool
+  shared_memory_segment::try_retain_(slot_header& slot) const noexcept
+  {
+    auto count = slot.refcount.load();
+    do {
+      if (count == dead) {
+        return false;
+      }
+    } while (not slot.refcount.compare_exchange_weak(count, count + 1));
+    return true;
+  }
+
+  void
+  shared_memory_segment::retain(std::size_t const i) const noexcept
+  {
+    ++slot_(i).refcount;
+  }
+
+  void
+  shared_memory_segment::release(std::size_t const i) const noexcept
+  {
+    --slot_(i).refcount;
+  }
+
+  bool
+  shared_memory_segment::holds_(std::size_t const i,
+                                void const* key,
+                                std::uint64_t const hash) const noexcept
+  {
+    return slot_(i).hash == hash and
+           std::memcmp(this->key(i), key, key_size_) == 0;
+  }
+
+  bool
+  shared_memory_segment::retain_if_holds_(std::size_t const i,
+                                          void const* key,
+                                          std::uint64_t const hash) const
+    noexcept
+  {
+    // A slot that is dropped may be reclaimed for another key while
+    // it is inspected, so the key is compared again once the
+    // reference keeps the slot from being dropped.
+    auto& slot = slot_(i);
+    if (not holds_(i, key, hash) or not try_retain_(slot)) {
+      return false;
+    }
+    if (slot.state.load(std::memory_order_acquire) == ready and
+        holds_(i, key, hash)) {
+      return true;
+    }
+    --slot.refcount;
+    return false;
+  }
+
+  std::size_t
+  shared_memory_segment::find(void const* key) const
+  {
+    auto const& header = header_();
+    auto const mask = header.n_slots - 1;
+    auto const hash = hash_bytes(key, key_size_);
+    auto i = hash & mask;
+    for (std::size_t n{}; n != header.n_slots; ++n, i = (i + 1) & mask) {
+      auto& slot = slot_(i);
+      auto state = slot.state.load(std::memory_order_acquire);
+      if (state == empty) {
+        return npos;
+      }
+      // The key is being written.
+      wait_until(
+        name_,
+        [&slot, &state] {
+          state = slot.state.load(std::memory_order_acquire);
+          return state != claimed;
+        },
+        "a key to be written");
+      if (state == ready and retain_if_holds_(i, key, hash)) {
+        return i;
+      }
+    }
+    return npos;
+  }
+
+  std::pair<std::size_t, bool>
+  shared_memory_segment::find_or_claim(void const* key)
+  {
+    auto const hash = hash_bytes(key, key_size_);
+    for (;;) {
+      if (auto const result = probe_(key, hash); result.first != npos) {
+        return result;
+      }
+      // The key is absent.  Claims are serialized, so that a key is
+      // not claimed twice even though dropped slots are reused.
+      claim_guard const lock{header_().claim_owner};
+      if (auto const i = claim_(key, hash); i != npos) {
+        return {i, true};
+      }
+      // Claimed by another thread or process since it was probed.
+    }
+  }
+
+  std::pair<std::size_t, bool>
+  shared_memory_segment::probe_(void const* key, std::uint64_t const hash)
+  {
+    auto const& header = header_();
+    auto const mask = header.n_slots - 1;
+    auto i = hash & mask;
+    for (std::size_t n{}; n != header.n_slots; ++n, i = (i + 1) & mask) {
+      auto& slot = slot_(i);
+      auto state = slot.state.load(std::memory_order_acquire);
+      if (state == empty) {
+        break;
+      }
+      wait_until(
+        name_,
+        [&slot, &state] {
+          state = slot.state.load(std::memory_order_acquire);
+          return state != claimed;
+        },
+        "a key to be written");
+      if (state == dropped or not holds_(i, key, hash)) {
+        continue;
+      }
+      auto next_check = std::chrono::steady_clock::now();
+      while (state == loading) {
+        // The key is being loaded elsewhere.  If the loading process
+        // has terminated, this process takes over the load.  The data
+        // block the terminated process may have allocated is not
+        // reclaimed.
+        if (auto const now = std::chrono::steady_clock::now();
+            now >= next_check) {
+          next_check = now + owner_check_interval;
+          auto owner = slot.owner.load();
+          if (is_dead(owner) and
+              slot.owner.compare_exchange_strong(owner, ::getpid())) {
+            slot.offset = 0u;
+            slot.n_elements = 0u;
+            return {i, true};
+          }
+        }
+        std::this_thread::yield();
+        state = slot.state.load(std::memory_order_acquire);
+      }
+      if (state == ready and retain_if_holds_(i, key, hash)) {
+        return {i, false};
+      }
+      // Abandoned or dropped; a later slot may hold the key.
+    }
+    return {npos, false};
+  }
+
+  std::size_t
+  shared_memory_segment::claim_(void const* key, std::uint64_t const hash)
+  {
+    // Called with the claim lock held.  Slots become claimed only
+    // while it is held, so no other slot can start to hold the key;
+    // a slot left claimed by a terminated process is skipped.
+    auto& header = header_();
+    auto const mask = header.n_slots - 1;
+    auto target = npos;
+    auto i = hash & mask;
+    for (std::size_t n{}; n != header.n_slots; ++n, i = (i + 1) & mask) {
+      auto const state = slot_(i).state.load(std::memory_order_acquire);
+      if (state == empty or state == dropped) {
+        if (target == npos) {
+          target = i;
+        }
+        if (state == empty) {
+          break;
+        }
+        continue;
+      }
+      if ((state == loading or state == ready) and holds_(i, key, hash)) {
+        return npos;
+      }
+    }
+
+    // At most max_entries slots are neither empty nor dropped, which
+    // is at most half of them, so a target has been found.
+    auto n = header.n_reserved.load();
+    do {
+      if (n >= header.max_entries) {
+        throw cet::exception("Shared memory cache error.")
+          << "The maximum number of entries (" << header.max_entries
+          << ") is held.\n";
+      }
+    } while (not header.n_reserved.compare_exchange_weak(n, n + 1));
+
+    auto& slot = slot_(target);
+    slot.state.store(claimed);
+    slot.refcount.store(dead);
+    slot.owner.store(::getpid());
+    slot.hash = hash;
+    std::memcpy(
+      reinterpret_cast<std::byte*>(&slot) + sizeof(slot_header), key, key_size_);
+    slot.state.store(loading, std::memory_order_release);
+    return target;
+  }
+
+  std::byte*
+  shared_memory_segment::allocate(std::size_t const i,
+                                  std::size_t const n_elements)
+  {
+    auto& slot = slot_(i);
+    auto const bytes = n_elements * element_size_;
+    slot.offset = bytes == 0ull ? 0ull : allocate_block_(bytes);
+    slot.n_elements = n_elements;
+    return data_base_() + slot.offset;
+  }
+
+  void
+  shared_memory_segment::publish(std::size_t const i) noexcept
+  {
+    auto& slot = slot_(i);
+    slot.refcount.store(1u); // Owned by the caller
+    slot.state.store(ready, std::memory_order_release);
+    ++header_().n_entries;
+  }
+
+  void
+  shared_memory_segment::abandon(std::size_t const i) noexcept
+  {
+    auto& slot = slot_(i);
+    if (auto const bytes = slot.n_elements * element_size_; bytes != 0ull) {
+      free_block_(slot.offset, bytes);
+    }
+    slot.refcount.store(dead);
+    slot.state.store(dropped, std::memory_order_release);
+    --header_().n_reserved;
+  }
+
+  std::size_t
+  shared_memory_segment::drop_unused()
+  {
+    auto& header = header_();
+    std::size_t n_dropped{};
+    for (std::size_t i{}; i != header.n_slots; ++i) {
+      auto& slot = slot_(i);
+      if (slot.state.load(std::memory_order_acquire) != ready) {
+        continue;
+      }
+      auto unused = 0u;
+      if (not slot.refcount.compare_exchange_strong(unused, dead)) {
+        continue;
+      }
+      if (auto const bytes = slot.n_elements * element_size_; bytes != 0ull) {
+        free_block_(slot.offset, bytes);
+      }
+      slot.state.store(dropped, std::memory_order_release);
+      --header.n_entries;
+      --header.n_reserved;
+      ++n_dropped;
+    }
+    return n_dropped;
+  }
+
+  std::size_t
+  shared_memory_segment::size() const noexcept
+  {
+    return header_().n_entries;
+  }
+
+  std::size_t
+  shared_memory_segment::bytes_used() const noexcept
+  {
+    return header_().bytes_used;
+  }
+
+  std::size_t
+  shared_memory_segment::allocate_block_(std::size_t const bytes)
+  {
+    auto& header = header_();
+    auto const block = block_size(bytes);
+    auto const c = size_class(block);
+    if (c >= n_size_classes) {
+      throw cet::exception("Shared memory cache error.")
+        << "A value of " << bytes << " bytes is too large.\n";
+    }
+
+    // Reuse a block of the same size, if available (Treiber stack).
+    auto& free_list = header.free_lists[c];
+    auto head = free_list.load(std::memory_order_acquire);
+    while ((head & link_mask) != 0u) {
+      auto const offset = (head & link_mask) - 1;
+      // The block may be reused concurrently, in which case the value
+      // read is garbage, but the tag makes the exchange fail.
+      auto* link = reinterpret_cast<std::uint64_t*>(data_base_() + offset);
+      auto const next =
+        std::atomic_ref{*link}.load(std::memory_order_relaxed);
+      auto const tag = (head >> link_bits) + 1;
+      if (free_list.compare_exchange_weak(head,
+                                          (tag << link_bits) | next,
+                                          std::memory_order_acq_rel)) {
+        header.bytes_used += block;
+        return offset;
+      }
+    }
+
+    auto top = header.data_top.load();
+    do {
+      if (top + block > header.data_bytes) {
+        throw cet::exception("Shared memory cache error.")
+          << "The data area (" << header.data_bytes
+          << " bytes) is exhausted.\n";
+      }
+    } while (not header.data_top.compare_exchange_weak(top, top + block));
+    header.bytes_used += block;
+    return top;
+  }
+
+  void
+  shared_memory_segment::free_block_(std::size_t const offset,
+                                     std::size_t const bytes) noexcept
+  {
+    auto& header = header_();
+    auto const block = block_size(bytes);
+    auto& free_list = header.free_lists[size_class(block)];
+    std::atomic_ref next{
+      *reinterpret_cast<std::uint64_t*>(data_base_() + offset)};
+    auto head = free_list.load(std::memory_order_relaxed);
+    std::uint64_t new_head;
+    do {
+      next.store(head & link_mask, std::memory_order_relaxed);
+      new_head = (((head >> link_bits) + 1) << link_bits) | (offset + 1);
+    } while (not free_list.compare_exchange_weak(
+      head, new_head, std::memory_order_release, std::memory_order_relaxed));
+    header.bytes_used -= block;
+  }
+
+} // namespace hep::concurrency::detail
@@ -0,0 +1,374 @@
+#ifndef hep_concurrency_shared_memory_cache_h
+#define hep_concurrency_shared_memory_cache_h
+
+// ====================================================================
+// A shared_memory_cache keeps its entries in a POSIX shared-memory
+// segment, so that all processes on a node that open the cache under
+// the same name share one copy of each payload:
+//
+//   shared_memory_cache<iov, float> pedestals{"/pedestals_v3"};
+//   auto h = pedestals.emplace(key, [&key] { return load(key); });
+//   std::span<float const> values = *h;
+//
+// The value of an entry is an array of elements of type T, which must
+// be trivially copyable, as must the key.  The loading function passed
+// to emplace(...) returns any contiguous range of T (e.g. a
+// std::vector<T>); it is called only if no process has loaded the key
+// yet.  While one process loads a key, the others calling emplace(...)
+// for it wait for the load to complete, so each payload is loaded
+// once per node.  If the loading function throws, the exception is
+// propagated to the caller, and a waiting process loads the key
+// itself.
+//
+// Index and reference counts
+// --------------------------
+//
+// The entries are located through an open-addressing index whose
+// slots are published with atomic operations on the segment; lookups
+// take no locks.  Claiming a slot for a new key takes a segment-wide
+// spin lock, which is taken over if its holder has terminated.  Keys
+// are hashed and compared by their object representation, so keys
+// must not contain padding.  As with cache, each entry has a
+// reference count, held in the segment and therefore shared by all
+// processes; a handle keeps its entry from being removed by
+// drop_unused() in any process.  The data of removed entries are
+// returned to per-size free lists and reused.
+//
+// Limitations
+// -----------
+//
+// - The segment does not grow.  Its size is determined by the options
+//   of the process that creates it; processes that open an existing
+//   segment must pass the same options.  At most max_entries entries
+//   (including those being loaded) are held at a time; the index
+//   slots of removed entries are reused by later insertions.  Data
+//   allocations are rounded up to powers of two.
+//
+// - A process that terminates while loading a key is detected by the
+//   processes waiting for the key, one of which then loads the key
+//   itself; the data block allocated by the terminated process, if
+//   any, is not reused.  This requires all processes to share one
+//   PID namespace.  A process that terminates while holding handles
+//   leaves the entries referenced until the segment is removed.
+//
+// - A process that waits more than 30 seconds for another process to
+//   write a key into the index (which normally takes microseconds)
+//   throws an exception.
+//
+// - The segment persists after all processes have unmapped it, until
+//   shared_memory_cache<...>::remove(name) is called (e.g. by the job
+//   launcher) or the node is rebooted.
+//
+// A handle must not outlive the shared_memory_cache object that
+// created it.
+// ====================================================================
+
+#include "cetlib_except/exception.h"
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <ranges>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace hep::concurrency {
+
+  struct shared_memory_options {
+    std::size_t max_entries{1024ull};
+    std::size_t data_bytes{std::size_t{64} << 20};
+  };
+
+  namespace detail {
+    template <typename T>
+    concept shared_memory_key = std::is_trivially_copyable_v<T> and
+                                std::has_unique_object_representations_v<T> and
+                                alignof(T) <= 16;
+
+    template <typename T>
+    concept shared_memory_value =
+      std::is_trivially_copyable_v<T> and alignof(T) <= 64;
+
+    // Type-erased view of the shared-memory segment (see
+    // shared_memory_cache.cc).  Slots returned by find(...) and
+    // find_or_claim(...) carry a reference owned by the caller.
+    class shared_memory_segment {
+    public:
+      static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+      shared_memory_segment(std::string const& name,
+                            std::size_t key_size,
+                            std::size_t element_size,
+                            shared_memory_options const& options);
+      ~shared_memory_segment();
+
+      // Disable copy operations
+      shared_memory_segment(shared_memory_segment const&) = delete;
+      shared_memory_segment& operator=(shared_memory_segment const&) = delete;
+
+      std::size_t find(void const* key) const;
+      // Returns (slot, true) if the caller has claimed the key and
+      // must either publish(...) or abandon(...) the slot.
+      std::pair<std::size_t, bool> find_or_claim(void const* key);
+      std::byte* allocate(std::size_t slot, std::size_t n_elements);
+      void publish(std::size_t slot) noexcept;
+      void abandon(std::size_t slot) noexcept;
+
+      void retain(std::size_t slot) const noexcept;
+      void release(std::size_t slot) const noexcept;
+      void const* key(std::size_t slot) const noexcept;
+      std::byte const* data(std::size_t slot) const noexcept;
+      std::size_t n_elements(std::size_t slot) const noexcept;
+
+      std::size_t drop_unused();
+      std::size_t size() const noexcept;
+      std::size_t bytes_used() const noexcept;
+
+      static bool remove(std::string const& name);
+
+    private:
+      struct segment_header;
+      struct slot_header;
+
+      segment_header& header_() const noexcept;
+      slot_header& slot_(std::size_t i) const noexcept;
+      std::byte* data_base_() const noexcept;
+      bool try_retain_(slot_header& slot) const noexcept;
+      bool holds_(std::size_t i,
+                  void const* key,
+                  std::uint64_t hash) const noexcept;
+      bool retain_if_holds_(std::size_t i,
+                            void const* key,
+                            std::uint64_t hash) const noexcept;
+      std::pair<std::size_t, bool> probe_(void const* key, std::uint64_t hash);
+      std::size_t claim_(void const* key, std::uint64_t hash);
+      std::size_t allocate_block_(std::size_t bytes);
+      void free_block_(std::size_t offset, std::size_t bytes) noexcept;
+      void initialize_(shared_memory_options const& options,
+                       std::size_t n_slots);
+      void validate_(std::string const& name,
+                     shared_memory_options const& options,
+                     std::size_t n_slots) const;
+
+      std::string name_;
+      std::byte* base_{nullptr};
+      std::size_t mapped_bytes_{};
+      std::size_t key_size_;
+      std::size_t element_size_;
+      std::size_t slot_size_{};
+      std::size_t slots_offset_{};
+      std::size_t data_offset_{};
+    };
+  }
+
+  template <detail::shared_memory_key Key, detail::shared_memory_value T>
+  class shared_memory_cache {
+  public:
+    class handle;
+
+    explicit shared_memory_cache(std::string const& name,
+                                 shared_memory_options const& options = {})
+      : segment_{name, sizeof(Key), sizeof(T), options}
+    {}
+
+    handle at(Key const& key) const;
+
+    handle emplace(Key const& key, std::span<T const> values);
+    template <std::invocable F>
+      requires std::ranges::contiguous_range<std::invoke_result_t<F&>> and
+               std::ranges::sized_range<std::invoke_result_t<F&>> and
+               std::same_as<
+                 std::ranges::range_value_t<std::invoke_result_t<F&>>,
+                 T>
+    handle emplace(Key const& key, F&& load);
+
+    // Removes all unused entries; returns the number removed.
+    std::size_t
+    drop_unused()
+    {
+      return segment_.drop_unused();
+    }
+
+    // Number of entries, and bytes allocated to their values
+    std::size_t
+    size() const noexcept
+    {
+      return segment_.size();
+    }
+    std::size_t
+    bytes_used() const noexcept
+    {
+      return segment_.bytes_used();
+    }
+
+    // Removes the segment's name; processes that have mapped the
+    // segment can continue to use it.
+    static bool
+    remove(std::string const& name)
+    {
+      return detail::shared_memory_segment::remove(name);
+    }
+
+  private:
+    detail::shared_memory_segment segment_;
+  };
+
+  template <detail::shared_memory_key Key, detail::shared_memory_value T>
+  class shared_memory_cache<Key, T>::handle {
+  public:
+    static constexpr handle
+    invalid() noexcept
+    {
+      return {};
+    }
+    ~handle() noexcept { invalidate(); }
+
+    handle(handle const& other) noexcept
+      : segment_{other.segment_}, slot_{other.slot_}
+    {
+      if (segment_) {
+        segment_->retain(slot_);
+      }
+    }
+    handle&
+    operator=(handle const& other) noexcept
+    {
+      if (other.segment_) {
+        other.segment_->retain(other.slot_);
+      }
+      invalidate();
+      segment_ = other.segment_;
+      slot_ = other.slot_;
+      return *this;
+    }
+    handle(handle&& other) noexcept
+      : segment_{std::exchange(other.segment_, nullptr)}, slot_{other.slot_}
+    {}
+    handle&
+    operator=(handle&& other) noexcept
+    {
+      if (this != &other) {
+        invalidate();
+        segment_ = std::exchange(other.segment_, nullptr);
+        slot_ = other.slot_;
+      }
+      return *this;
+    }
+
+    bool
+    is_valid() const noexcept
+    {
+      return segment_ != nullptr;
+    }
+    explicit operator bool() const noexcept { return is_valid(); }
+
+    std::span<T const>
+    operator*() const
+    {
+      if (segment_ == nullptr) {
+        throw cet::exception("Invalid cache handle dereference.")
+          << "Handle does not refer to any cache entry.";
+      }
+      auto const* values = std::launder(
+        reinterpret_cast<T const*>(segment_->data(slot_)));
+      return {values, segment_->n_elements(slot_)};
+    }
+
+    Key const&
+    key() const
+    {
+      if (segment_ == nullptr) {
+        throw cet::exception("Invalid key access.")
+          << "Handle does not refer to any cache entry.";
+      }
+      return *std::launder(static_cast<Key const*>(segment_->key(slot_)));
+    }
+
+    void
+    invalidate() noexcept
+    {
+      if (segment_) {
+        segment_->release(slot_);
+        segment_ = nullptr;
+      }
+    }
+
+  private:
+    friend class shared_memory_cache;
+
+    constexpr handle() = default;
+
+    // Takes over the reference acquired by the caller.
+    handle(detail::shared_memory_segment const* segment,
+           std::size_t const slot) noexcept
+      : segment_{segment}, slot_{slot}
+    {}
+
+    detail::shared_memory_segment const* segment_{nullptr};
+    std::size_t slot_{};
+  };
+
+  // ----------------------------------------------------------------------------
+  // Implementation below
+
+  template <detail::shared_memory_key Key, detail::shared_memory_value T>
+  auto
+  shared_memory_cache<Key, T>::at(Key const& key) const -> handle
+  {
+    auto const slot = segment_.find(&key);
+    if (slot == detail::shared_memory_segment::npos) {
+      return handle::invalid();
+    }
+    return handle{&segment_, slot};
+  }
+
+  template <detail::shared_memory_key Key, detail::shared_memory_value T>
+  auto
+  shared_memory_cache<Key, T>::emplace(Key const& key,
+                                       std::span<T const> const values)
+    -> handle
+  {
+    return emplace(key, [values] { return values; });
+  }
+
+  template <detail::shared_memory_key Key, detail::shared_memory_value T>
+  template <std::invocable F>
+    requires std::ranges::contiguous_range<std::invoke_result_t<F&>> and
+             std::ranges::sized_range<std::invoke_result_t<F&>> and
+             std::same_as<std::ranges::range_value_t<std::invoke_result_t<F&>>,
+                          T>
+  auto
+  shared_memory_cache<Key, T>::emplace(Key const& key, F&& load) -> handle
+  {
+    auto const [slot, claimed] = segment_.find_or_claim(&key);
+    if (not claimed) {
+      return handle{&segment_, slot};
+    }
+
+    try {
+      auto&& values = std::invoke(load);
+      auto const n = static_cast<std::size_t>(std::ranges::size(values));
+      auto* bytes = segment_.allocate(slot, n);
+      if (n != 0ull) {
+        std::memcpy(bytes, std::ranges::data(values), n * sizeof(T));
+      }
+    }
+    catch (...) {
+      segment_.abandon(slot);
+      throw;
+    }
+    segment_.publish(slot);
+    return handle{&segment_, slot};
+  }
+}
+
+#endif /* hep_concurrency_shared_memory_cache_h */
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,173 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_string.hpp>
+
+#include "hep_concurrency/cache_access_log.h"
+#include "interval_of_validity.h"
+
+#include "tbb/parallel_for.h"
+#include "tbb/task_group.h"
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+using namespace hep::concurrency;
+using Catch::Matchers::ContainsSubstring;
+
+namespace {
+  std::string
+  temporary_file(std::string const& name)
+  {
+    return (std::filesystem::temp_directory_path() / name).string();
+  }
+}
+
+TEST_CASE("Record cache accesses")
+{
+  cache<int, int> numbers;
+  auto const filename = temporary_file("cache_access_log_t.hcal");
+  {
+    cache_access_recorder recorder{numbers};
+    numbers.emplace(1, 10);
+    CHECK(not numbers.at(2)); // Misses are not recorded
+    numbers.emplace(2, 20);
+    numbers.at(1);
+    CHECK(numbers.visit(2, [](int, int) {}));
+    numbers.for_each([](int, int) {}); // Not recorded
+
+    auto const log = recorder.log();
+    REQUIRE(std::size(log) == 4ull);
+    std::vector<int> keys;
+    for (std::size_t i{}; i != std::size(log); ++i) {
+      CHECK(log[i].sequence == i);
+      if (i != 0ull) {
+        CHECK(log[i - 1].time <= log[i].time);
+      }
+      keys.push_back(log[i].key);
+    }
+    CHECK(keys == std::vector{1, 2, 1, 2});
+    recorder.write(filename);
+  }
+  numbers.at(1); // The hook is removed with the recorder.
+
+  auto const log = read_cache_access_log<int>(filename);
+  REQUIRE(std::size(log) == 4ull);
+  CHECK(log[2].sequence == 2ull);
+  CHECK(log[2].key == 1);
+  CHECK(log[1].time <= log[2].time);
+
+  CHECK_THROWS_WITH(read_cache_access_log<long long>(filename),
+                    ContainsSubstring("key size does not match"));
+  std::ofstream{filename} << "not a log";
+  CHECK_THROWS_WITH(read_cache_access_log<int>(filename),
+                    ContainsSubstring("not a cache access log"));
+  std::filesystem::remove(filename);
+}
+
+TEST_CASE("Record accesses satisfied by a hint")
+{
+  using test::interval_of_validity;
+  cache<interval_of_validity, int> runs;
+  auto h = runs.emplace({0, 10}, 1);
+  cache_access_recorder recorder{runs};
+  for (unsigned i{}; i != 10u; ++i) {
+    h = runs.entry_for(h, i);
+  }
+  CHECK(std::size(recorder.log()) == 10ull);
+}
+
+TEST_CASE("Record cache accesses (multi-threaded)")
+{
+  cache<int, int> numbers;
+  for (int i{}; i != 10; ++i) {
+    numbers.emplace(i, i);
+  }
+  cache_access_recorder recorder{numbers};
+  tbb::parallel_for(0, 1000, [&numbers](int const i) { numbers.at(i % 10); });
+
+  auto const log = recorder.log();
+  REQUIRE(std::size(log) == 1000ull);
+  std::vector<int> counts(10);
+  for (auto const& access : log) {
+    ++counts[access.key];
+  }
+  CHECK(counts == std::vector<int>(10, 100));
+}
+
+TEST_CASE("Prefetch from access log")
+{
+  cache_access_log<int> log;
+  for (int const key : {0, 1, 0, 2, 3, 2, 4, 5}) {
+    log.push_back({std::size(log), {}, key});
+  }
+
+  tbb::task_group group;
+  cache<int, int> numbers;
+  std::atomic<int> n_loads{};
+  auto load = [&n_loads](int const key) {
+    ++n_loads;
+    if (key == 4) {
+      throw std::runtime_error("No payload");
+    }
+    return key * 10;
+  };
+  {
+    cache_prefetcher prefetcher{numbers, group, log, load, {.lookahead = 2}};
+    group.wait();
+    CHECK(numbers.size() == 2ull); // Keys 0 and 1
+    CHECK(prefetcher.position() == 0ull);
+
+    numbers.at(0);
+    group.wait();
+    CHECK(prefetcher.position() == 1ull);
+    CHECK(numbers.size() == 3ull); // And key 2
+
+    // Skipping ahead in the schedule prefetches beyond the key reached.
+    numbers.emplace(3, 30);
+    group.wait();
+    CHECK(prefetcher.position() == 4ull);
+    CHECK(numbers.at(5));
+    CHECK(not numbers.at(4));
+    CHECK(prefetcher.loaded() == 4ull); // Keys 0, 1, 2 and 5
+    CHECK(prefetcher.failed() == 1ull);
+  }
+  CHECK(n_loads == 5);
+}
+
+TEST_CASE("Destroy a prefetcher with pending loads")
+{
+  cache_access_log<int> log;
+  for (int key{}; key != 100; ++key) {
+    log.push_back({std::size(log), {}, key});
+  }
+  tbb::task_group group;
+  cache<int, int> numbers;
+  {
+    cache_prefetcher prefetcher{
+      numbers, group, log, [](int const key) { return key; }, {}};
+    // The destructor runs the pending loads if no other thread does.
+  }
+  group.wait();
+  CHECK(numbers.size() > 0ull);
+}
+
+TEST_CASE("One access hook per cache")
+{
+  tbb::task_group group;
+  cache<int, int> numbers;
+  using prefetcher_t = cache_prefetcher<int, int>;
+  auto load = [](int const key) { return key; };
+  {
+    cache_access_recorder recorder{numbers};
+    CHECK_THROWS_WITH((prefetcher_t{numbers, group, {{0, {}, 1}}, load, {}}),
+                      ContainsSubstring("hook is already set"));
+    // The recorder's hook is still in place.
+    numbers.emplace(1, 1);
+    CHECK(std::size(recorder.log()) == 1ull);
+  }
+  // The recorder removed its hook.
+  prefetcher_t prefetcher{numbers, group, {{0, {}, 1}}, load, {}};
+  group.wait();
+}
@@ -0,0 +1,486 @@
+// ===================================================================
+// Throughput and latency benchmark for the cache class template.
+//
+// For each storage backend (tbb_backend and open_addressing_backend;
+// see cache_backends.h) and key type (integral, interval_of_validity,
+// and string), the benchmark sweeps over the number of cache entries
+// (by factors of 10) and the number of threads, measuring:
+//
+//   at                   -- lookups of random, existing keys
+//   entry_for            -- lookups of random values (interval keys
+//                           only)
+//   entry_for_hint       -- lookups of increasing values, passing the
+//                           previous handle as a hint (interval keys
+//                           only)
+//   emplace_race         -- all threads emplace the same set of keys
+//                           into an initially empty cache
+//   drop_unused_but_last -- one drop_unused_but_last(n/2) call, made
+//                           while the remaining threads call at(...)
+//
+// Each result is printed as one line of JSON (or CSV with --csv) that
+// includes the throughput and the median, 99th-, 99.9th-percentile,
+// and maximum per-operation latencies in nanoseconds.
+//
+// Usage:
+//
+//   cache_benchmark [--min-entries N] [--max-entries N] [--ops N]
+//                   [--threads N1,N2,...] [--keys int,iov,string]
+//                   [--backends tbb,open] [--csv]
+//
+// Because entry_for(...) scans all keys, the number of entry_for
+// operations per thread is reduced for large caches so that each
+// thread performs at most ~10^7 key comparisons.  The open-addressing
+// caches are sized with reserve(n) before use, as they require.
+// ===================================================================
+
+#include "hep_concurrency/cache.h"
+#include "hep_concurrency/simultaneous_function_spawner.h"
+#include "interval_of_validity.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+using hep::concurrency::cache;
+using hep::concurrency::open_addressing_backend;
+using hep::concurrency::tbb_backend;
+using hep::concurrency::repeated_task;
+using hep::concurrency::simultaneous_function_spawner;
+using hep::concurrency::test::interval_of_validity;
+
+namespace {
+
+  using clock_type = std::chrono::steady_clock;
+
+  struct config {
+    std::size_t min_entries{10};
+    std::size_t max_entries{1'000'000};
+    std::size_t ops{100'000};
+    std::vector<unsigned> threads{};
+    std::vector<std::string> keys{"int", "iov", "string"};
+    std::vector<std::string> backends{"tbb", "open"};
+    bool csv{false};
+  };
+
+  struct result {
+    std::string backend;
+    std::string key;
+    std::size_t entries;
+    unsigned threads;
+    std::string op;
+    std::size_t ops;
+    double seconds;
+    std::vector<std::int64_t> latencies;
+  };
+
+  std::vector<std::string>
+  split(std::string const& list)
+  {
+    std::vector<std::string> result;
+    std::istringstream is{list};
+    for (std::string item; std::getline(is, item, ',');) {
+      result.push_back(item);
+    }
+    return result;
+  }
+
+  config
+  parse_args(int argc, char** argv)
+  {
+    config result;
+    for (int i = 1; i < argc; ++i) {
+      std::string const arg{argv[i]};
+      auto next = [&]() -> std::string {
+        if (i + 1 == argc) {
+          std::cerr << "Missing value for " << arg << '\n';
+          std::exit(1);
+        }
+        return argv[++i];
+      };
+      if (arg == "--min-entries") {
+        result.min_entries = std::stoull(next());
+      } else if (arg == "--max-entries") {
+        result.max_entries = std::stoull(next());
+      } else if (arg == "--ops") {
+        result.ops = std::stoull(next());
+      } else if (arg == "--threads") {
+        for (auto const& n : split(next())) {
+          result.threads.push_back(std::stoul(n));
+        }
+      } else if (arg == "--keys") {
+        result.keys = split(next());
+      } else if (arg == "--backends") {
+        result.backends = split(next());
+      } else if (arg == "--csv") {
+        result.csv = true;
+      } else {
+        std::cerr << "Unknown argument: " << arg << '\n';
+        std::exit(1);
+      }
+    }
+
+    if (result.min_entries == 0ull) {
+      result.min_entries = 1ull;
+    }
+
+    if (empty(result.threads)) {
+      auto const max_threads =
+        std::max(1u, std::thread::hardware_concurrency());
+      for (unsigned n = 1; n < max_threads; n *= 2) {
+        result.threads.push_back(n);
+      }
+      result.threads.push_back(max_threads);
+    }
+    return result;
+  }
+
+  // -----------------------------------------------------------------
+  // Key generation
+
+  template <typename Key>
+  Key make_key(std::size_t i);
+
+  template <>
+  unsigned
+  make_key<unsigned>(std::size_t const i)
+  {
+    return i;
+  }
+
+  template <>
+  interval_of_validity
+  make_key<interval_of_validity>(std::size_t const i)
+  {
+    return interval_of_validity{static_cast<unsigned>(10 * i),
+                                static_cast<unsigned>(10 * i + 10)};
+  }
+
+  template <>
+  std::string
+  make_key<std::string>(std::size_t const i)
+  {
+    return "calibration_key_" + std::to_string(i);
+  }
+
+  template <typename Key>
+  constexpr bool supports_entry_for =
+    std::is_same_v<Key, interval_of_validity>;
+
+  // -----------------------------------------------------------------
+  // Measurement
+
+  // Runs body(thread_index, latencies) on n_threads simultaneously
+  // started threads, and returns the wall-clock time.
+  template <typename F>
+  double
+  run_threads(unsigned const n_threads,
+              std::vector<std::vector<std::int64_t>>& latencies,
+              F body)
+  {
+    latencies.assign(n_threads, {});
+    std::atomic<unsigned> next_index{0u};
+    std::function<void()> task = [&] {
+      auto const index = next_index++;
+      body(index, latencies[index]);
+    };
+    auto const start = clock_type::now();
+    simultaneous_function_spawner{repeated_task(n_threads, task)};
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+  }
+
+  template <typename F>
+  void
+  timed(std::vector<std::int64_t>& latencies, F f)
+  {
+    auto const start = clock_type::now();
+    f();
+    latencies.push_back(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() -
+                                                           start)
+        .count());
+  }
+
+  result
+  make_result(std::string const& backend,
+              std::string const& key,
+              std::size_t const entries,
+              unsigned const threads,
+              std::string const& op,
+              double const seconds,
+              std::vector<std::vector<std::int64_t>> const& per_thread)
+  {
+    result r{backend, key, entries, threads, op, 0, seconds, {}};
+    for (auto const& latencies : per_thread) {
+      r.latencies.insert(end(r.latencies), begin(latencies), end(latencies));
+    }
+    r.ops = size(r.latencies);
+    std::sort(begin(r.latencies), end(r.latencies));
+    return r;
+  }
+
+  std::int64_t
+  percentile(std::vector<std::int64_t> const& sorted, double const p)
+  {
+    if (empty(sorted)) {
+      return 0;
+    }
+    auto const index = static_cast<std::size_t>(p * (size(sorted) - 1));
+    return sorted[index];
+  }
+
+  void
+  report(result const& r, bool const csv)
+  {
+    auto const throughput = r.seconds > 0. ? r.ops / r.seconds : 0.;
+    if (csv) {
+      std::cout << r.backend << ',' << r.key << ',' << r.entries << ','
+                << r.threads << ',' << r.op << ',' << r.ops << ','
+                << r.seconds << ',' << throughput << ','
+                << percentile(r.latencies, 0.5) << ','
+                << percentile(r.latencies, 0.99) << ','
+                << percentile(r.latencies, 0.999) << ','
+                << percentile(r.latencies, 1.) << '\n';
+      return;
+    }
+    std::cout << "{\"backend\": \"" << r.backend << "\", \"key\": \""
+              << r.key << "\", \"entries\": " << r.entries
+              << ", \"threads\": " << r.threads << ", \"op\": \"" << r.op
+              << "\", \"ops\": " << r.ops << ", \"seconds\": " << r.seconds
+              << ", \"ops_per_second\": " << throughput
+              << ", \"p50_ns\": " << percentile(r.latencies, 0.5)
+              << ", \"p99_ns\": " << percentile(r.latencies, 0.99)
+              << ", \"p999_ns\": " << percentile(r.latencies, 0.999)
+              << ", \"max_ns\": " << percentile(r.latencies, 1.) << "}"
+              << std::endl;
+  }
+
+  // -----------------------------------------------------------------
+  // Benchmarks
+
+  // The open-addressing backend cannot grow during concurrent use.
+  template <typename Key, typename Backend>
+  void
+  prepare(cache<Key, std::size_t, Backend>& c, std::size_t const n_entries)
+  {
+    if constexpr (not std::is_same_v<Backend, tbb_backend>) {
+      c.reserve(n_entries);
+    }
+  }
+
+  template <typename Key, typename Backend>
+  void
+  fill(cache<Key, std::size_t, Backend>& c, std::size_t const n_entries)
+  {
+    prepare(c, n_entries);
+    for (std::size_t i = 0; i != n_entries; ++i) {
+      c.emplace(make_key<Key>(i), i);
+    }
+  }
+
+  template <typename Key, typename Backend>
+  void
+  benchmark(std::string const& backend_name,
+            std::string const& key_name,
+            std::size_t const n_entries,
+            unsigned const n_threads,
+            config const& cfg)
+  {
+    using cache_t = cache<Key, std::size_t, Backend>;
+    std::vector<std::vector<std::int64_t>> latencies;
+    std::vector<Key> keys;
+    keys.reserve(n_entries);
+    for (std::size_t i = 0; i != n_entries; ++i) {
+      keys.push_back(make_key<Key>(i));
+    }
+
+    {
+      cache_t c;
+      fill(c, n_entries);
+      auto const seconds =
+        run_threads(n_threads, latencies, [&](unsigned const index, auto& l) {
+          std::mt19937_64 engine{index};
+          std::uniform_int_distribution<std::size_t> pick{0, n_entries - 1};
+          l.reserve(cfg.ops);
+          for (std::size_t i = 0; i != cfg.ops; ++i) {
+            auto const& key = keys[pick(engine)];
+            timed(l, [&] { auto h = c.at(key); });
+          }
+        });
+      report(make_result(backend_name,
+                         key_name,
+                         n_entries,
+                         n_threads,
+                         "at",
+                         seconds,
+                         latencies),
+             cfg.csv);
+    }
+
+    if constexpr (supports_entry_for<Key>) {
+      cache_t c;
+      fill(c, n_entries);
+      auto const scan_ops =
+        std::clamp<std::size_t>(10'000'000 / n_entries, 1, cfg.ops);
+      auto const max_value = static_cast<unsigned>(10 * n_entries - 1);
+
+      auto seconds =
+        run_threads(n_threads, latencies, [&](unsigned const index, auto& l) {
+          std::mt19937_64 engine{index};
+          std::uniform_int_distribution<unsigned> pick{0, max_value};
+          l.reserve(scan_ops);
+          for (std::size_t i = 0; i != scan_ops; ++i) {
+            auto const value = pick(engine);
+            timed(l, [&] { auto h = c.entry_for(value); });
+          }
+        });
+      report(make_result(backend_name,
+                         key_name,
+                         n_entries,
+                         n_threads,
+                         "entry_for",
+                         seconds,
+                         latencies),
+             cfg.csv);
+
+      seconds =
+        run_threads(n_threads, latencies, [&](unsigned const index, auto& l) {
+          l.reserve(cfg.ops);
+          auto hint = cache_t::handle::invalid();
+          // Each thread walks through the values in order, so that only
+          // one in ten lookups misses the hint.
+          unsigned value = (index * max_value) / n_threads;
+          for (std::size_t i = 0; i != cfg.ops; ++i) {
+            timed(l, [&] { hint = c.entry_for(hint, value); });
+            value = value == max_value ? 0 : value + 1;
+          }
+        });
+      report(make_result(backend_name,
+                         key_name,
+                         n_entries,
+                         n_threads,
+                         "entry_for_hint",
+                         seconds,
+                         latencies),
+             cfg.csv);
+    }
+
+    {
+      cache_t c;
+      prepare(c, n_entries);
+      auto const seconds =
+        run_threads(n_threads, latencies, [&](unsigned const index, auto& l) {
+          std::vector<std::size_t> order(n_entries);
+          std::iota(begin(order), end(order), 0);
+          std::shuffle(begin(order), end(order), std::mt19937_64{index});
+          l.reserve(n_entries);
+          for (auto const i : order) {
+            timed(l, [&] { c.emplace(keys[i], i); });
+          }
+        });
+      report(make_result(backend_name,
+                         key_name,
+                         n_entries,
+                         n_threads,
+                         "emplace_race",
+                         seconds,
+                         latencies),
+             cfg.csv);
+    }
+
+    {
+      cache_t c;
+      fill(c, n_entries);
+      std::atomic<bool> dropped{false};
+      auto const seconds =
+        run_threads(n_threads, latencies, [&](unsigned const index, auto& l) {
+          if (index == 0u) {
+            timed(l, [&] { c.drop_unused_but_last(n_entries / 2); });
+            dropped = true;
+            return;
+          }
+          std::mt19937_64 engine{index};
+          std::uniform_int_distribution<std::size_t> pick{0, n_entries - 1};
+          while (not dropped) {
+            auto h = c.at(keys[pick(engine)]);
+          }
+        });
+      report(make_result(
+               backend_name,
+               key_name,
+               n_entries,
+               n_threads,
+               "drop_unused_but_last",
+               seconds,
+               latencies),
+             cfg.csv);
+    }
+  }
+
+  template <typename Key, typename Backend>
+  void
+  sweep(std::string const& backend_name,
+        std::string const& key_name,
+        config const& cfg)
+  {
+    for (auto n = cfg.min_entries; n <= cfg.max_entries; n *= 10) {
+      for (auto const threads : cfg.threads) {
+        benchmark<Key, Backend>(backend_name, key_name, n, threads, cfg);
+      }
+    }
+  }
+
+  template <typename Backend>
+  bool
+  sweep_keys(std::string const& backend_name, config const& cfg)
+  {
+    for (auto const& key : cfg.keys) {
+      if (key == "int") {
+        sweep<unsigned, Backend>(backend_name, key, cfg);
+      } else if (key == "iov") {
+        sweep<interval_of_validity, Backend>(backend_name, key, cfg);
+      } else if (key == "string") {
+        sweep<std::string, Backend>(backend_name, key, cfg);
+      } else {
+        std::cerr << "Unknown key type: " << key << '\n';
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  auto const cfg = parse_args(argc, argv);
+  if (cfg.csv) {
+    std::cout << "backend,key,entries,threads,op,ops,seconds,ops_per_second,"
+                 "p50_ns,p99_ns,p999_ns,max_ns\n";
+  }
+
+  for (auto const& backend : cfg.backends) {
+    bool ok{false};
+    if (backend == "tbb") {
+      ok = sweep_keys<tbb_backend>(backend, cfg);
+    } else if (backend == "open") {
+      ok = sweep_keys<open_addressing_backend<>>(backend, cfg);
+    } else {
+      std::cerr << "Unknown backend: " << backend << '\n';
+    }
+    if (not ok) {
+      return 1;
+    }
+  }
+}
@@ -3,6 +3,7 @@
 #include "hep_concurrency/cache.h"
 #include "interval_of_validity.h"
 
+#include "tbb/parallel_for.h"
 #include "tbb/parallel_for_each.h"
 
 #include <algorithm>
@@ -28,6 +29,13 @@ namespace {
 
   class CalibrationQuality {
   public:
+    explicit CalibrationQuality(bool const use_front_cache)
+    {
+      if (use_front_cache) {
+        calibration_quality_.enable_front_cache();
+      }
+    }
+
     auto
     quality_for(unsigned int const event)
     {
@@ -98,8 +106,12 @@ namespace {
 
   class count_data {
   public:
-    count_data(value_counter& counter, unsigned const drop_n = -1u)
-      : counter_{counter}, n_{drop_n}
+    count_data(value_counter& counter,
+               unsigned const drop_n = -1u,
+               bool const use_front_cache = false)
+      : calibration_{std::make_shared<CalibrationQuality>(use_front_cache)}
+      , counter_{counter}
+      , n_{drop_n}
     {}
 
     // This is the function that is potentially called from multiple threads.
@@ -114,8 +126,7 @@ namespace {
     }
 
   private:
-    std::shared_ptr<CalibrationQuality> calibration_{
-      std::make_shared<CalibrationQuality>()};
+    std::shared_ptr<CalibrationQuality> calibration_;
     value_counter& counter_;
     unsigned n_;
   };
@@ -177,3 +188,83 @@ TEST_CASE("User-defined (multi-threaded)")
     CHECK(counter.correct_tally());
   }
 }
+
+TEST_CASE("User-defined with front cache (multi-threaded)")
+{
+  auto const events = event_numbers();
+  value_counter counter;
+
+  SECTION("Drop nothing")
+  {
+    tbb::parallel_for_each(events, count_data{counter, -1u, true});
+    CHECK(counter.correct_tally());
+  }
+  SECTION("Drop all unused")
+  {
+    tbb::parallel_for_each(events, count_data{counter, 0, true});
+    CHECK(counter.correct_tally());
+  }
+  SECTION("Drop all but 1 unused")
+  {
+    tbb::parallel_for_each(events, count_data{counter, 1, true});
+    CHECK(counter.correct_tally());
+  }
+}
+
+TEST_CASE("Replace while reading (multi-threaded)")
+{
+  cache<int, std::vector<int>> tables;
+  tables.enable_front_cache();
+  tables.emplace(0, std::vector<int>(100, 0));
+
+  // Each version is filled with a single value, so a reader observing
+  // a mixture of values would indicate a torn update.
+  std::atomic<unsigned> n_invalid{};
+  std::atomic<unsigned> n_torn{};
+  tbb::parallel_for(0, 1000, [&](int const i) {
+    if (i % 10 == 0) {
+      tables.replace(0, std::vector<int>(100, i));
+      tables.drop_unused_but_last(1); // Reclaims previous versions
+      return;
+    }
+    auto h = tables.at(0);
+    if (not h) {
+      ++n_invalid;
+      return;
+    }
+    auto const& table = *h;
+    if (std::count(begin(table), end(table), table.front()) != 100) {
+      ++n_torn;
+    }
+  });
+  CHECK(n_invalid == 0u);
+  CHECK(n_torn == 0u);
+  CHECK(size(tables) == 1ull);
+  tables.drop_unused_but_last(1);
+  CHECK(tables.retained() == 0ull);
+}
+
+TEST_CASE("Open-addressing backend (multi-threaded)")
+{
+  using hep::concurrency::open_addressing_backend;
+  cache<unsigned, unsigned, open_addressing_backend<>> squares;
+  squares.reserve(256);
+  std::atomic<unsigned> n_correct{};
+  tbb::parallel_for(0u, 10'000u, [&](unsigned const i) {
+    auto const n = i % 200;
+    auto h = squares.at(n);
+    if (not h) {
+      h = squares.emplace(n, n * n);
+    }
+    if (*h == n * n) {
+      ++n_correct;
+    }
+    h.invalidate();
+    if (i % 13 == 0) {
+      squares.drop_unused_but_last(100);
+    }
+  });
+  CHECK(n_correct == 10'000u);
+  squares.shrink_to_fit();
+  CHECK(squares.size() <= 100ull);
+}
@@ -0,0 +1,128 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_string.hpp>
+
+#include "hep_concurrency/cache_reaper.h"
+
+#include "tbb/parallel_for.h"
+#include "tbb/task_group.h"
+
+#include <chrono>
+#include <vector>
+
+using namespace hep::concurrency;
+using Catch::Matchers::ContainsSubstring;
+
+TEST_CASE("Reap on entry count")
+{
+  tbb::task_group group;
+  cache<int, int> numbers;
+  {
+    cache_reaper reaper{
+      numbers, group, {.max_entries = 50, .keep_last = 10, .slice = 8}};
+    tbb::parallel_for(0, 1000, [&](int const i) { numbers.emplace(i, i); });
+    group.wait();
+    CHECK(reaper.passes() > 0ull);
+    CHECK(reaper.reaped() > 0ull);
+  }
+  // Insertions after the last pass may not have triggered another.
+  CHECK(numbers.size() < 1000ull);
+
+  // The hook is removed with the reaper.
+  numbers.emplace(-1, -1);
+  group.wait();
+}
+
+TEST_CASE("Reap on memory footprint")
+{
+  tbb::task_group group;
+  cache<int, std::vector<char>> buffers;
+  cache_reaper reaper{buffers,
+                      group,
+                      {.max_bytes = 10'000, .keep_last = 1, .sample_every = 4}};
+  for (int i{}; i != 20; ++i) {
+    buffers.emplace(i, std::vector<char>(1000));
+    group.wait();
+  }
+  CHECK(reaper.reaped() > 0ull);
+  CHECK(buffers.memory_usage().total() < 20'000ull);
+}
+
+TEST_CASE("Stop reaping once under the memory budget")
+{
+  tbb::task_group group;
+  cache<int, std::vector<char>> buffers;
+  cache_reaper reaper{
+    buffers,
+    group,
+    {.max_bytes = 20'000, .keep_last = 1, .slice = 2, .sample_every = 20}};
+  for (int i{}; i != 20; ++i) {
+    buffers.emplace(i, std::vector<char>(1000));
+  }
+  group.wait();
+  CHECK(reaper.passes() == 1ull);
+  CHECK(buffers.memory_usage().total() <= 20'000ull);
+  // Each slice checks the footprint, so the pass stops early.
+  CHECK(buffers.size() > 8ull);
+}
+
+TEST_CASE("Reaper thresholds must be positive")
+{
+  tbb::task_group group;
+  cache<int, int> numbers;
+  using reaper_t = cache_reaper<int, int>;
+  CHECK_THROWS_WITH((reaper_t{numbers, group, {.slice = 0}}),
+                    ContainsSubstring("must be positive"));
+  CHECK_THROWS_WITH((reaper_t{numbers, group, {.sample_every = 0}}),
+                    ContainsSubstring("must be positive"));
+  // No hook is left behind.
+  numbers.emplace(1, 1);
+}
+
+TEST_CASE("Destroy a reaper with a pending pass")
+{
+  tbb::task_group group;
+  cache<int, int> numbers;
+  numbers.emplace(1, 1);
+  {
+    cache_reaper reaper{numbers, group, {}};
+    reaper.request();
+    // The destructor does not wait for the pass to be run.
+  }
+  group.wait();
+}
+
+TEST_CASE("Reap on request and on interval")
+{
+  using namespace std::chrono_literals;
+  tbb::task_group group;
+  cache<int, int> numbers;
+  cache_reaper reaper{numbers, group, {.interval = 0s}};
+  numbers.emplace(1, 1); // Interval elapsed; the entry is dropped
+  group.wait();
+  CHECK(numbers.empty());
+  CHECK(reaper.passes() == 1ull);
+
+  auto h = numbers.emplace(2, 2);
+  group.wait();
+  CHECK(numbers.size() == 1ull);
+  h.invalidate();
+  reaper.request();
+  group.wait();
+  CHECK(numbers.empty());
+}
+
+TEST_CASE("One reaper per cache")
+{
+  tbb::task_group group;
+  cache<int, int> numbers;
+  cache_reaper reaper{numbers, group, {.max_entries = 2}};
+  using reaper_t = cache_reaper<int, int>;
+  CHECK_THROWS_WITH((reaper_t{numbers, group, {}}),
+                    ContainsSubstring("hook is already set"));
+  // The hook of the first reaper is left in place.
+  for (int i{}; i != 4; ++i) {
+    numbers.emplace(i, i);
+  }
+  group.wait();
+  CHECK(reaper.passes() > 0ull);
+}
@@ -0,0 +1,71 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "hep_concurrency/cache_registry.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace hep::concurrency;
+using namespace std::chrono_literals;
+
+TEST_CASE("Enrollment")
+{
+  cache_registry registry{1000};
+  cache<int, std::vector<char>> buffers;
+  buffers.emplace(1, std::vector<char>(100));
+  {
+    auto const enrolled = registry.enroll(buffers, "buffers");
+    auto const usage = registry.usage();
+    REQUIRE(std::size(usage) == 1ull);
+    CHECK(usage[0].name == "buffers");
+    CHECK(usage[0].usage.values >= 100ull);
+  }
+  CHECK(registry.usage().empty());
+}
+
+TEST_CASE("Enforce budget across caches")
+{
+  cache<int, std::vector<char>> cold;
+  cache<int, std::vector<char>> hot;
+  cache_registry registry{100'000};
+  auto const cold_enrolled = registry.enroll(cold, "cold");
+  auto const hot_enrolled = registry.enroll(hot, "hot");
+
+  for (int i{}; i != 10; ++i) {
+    cold.emplace(i, std::vector<char>(4'000));
+  }
+  auto pinned = cold.at(0);
+  std::this_thread::sleep_for(20ms);
+  for (int i{}; i != 10; ++i) {
+    hot.emplace(i, std::vector<char>(2'000));
+  }
+  CHECK(registry.enforce_budget() == 0ull); // Within the budget
+
+  // Exceed the budget by inserting into the hot cache.
+  for (int i{10}; i != 30; ++i) {
+    hot.emplace(i, std::vector<char>(2'000));
+  }
+  std::this_thread::sleep_for(5ms);
+  auto const n_removed = registry.enforce_budget();
+  CHECK(n_removed > 0ull);
+
+  std::size_t total{};
+  for (auto const& report : registry.usage()) {
+    total += report.usage.total();
+  }
+  CHECK(total <= registry.budget());
+  CHECK(cold.at(0)); // In use
+  CHECK(cold.size() < 10ull);
+  CHECK(hot.size() == 30ull); // Recently accessed and smaller
+
+  // Nothing can be removed if all entries are in use.
+  std::vector<cache<int, std::vector<char>>::handle> handles;
+  for (int i{}; i != 30; ++i) {
+    handles.push_back(hot.at(i));
+  }
+  cache_registry small{1};
+  auto const enrolled = small.enroll(hot);
+  CHECK(small.enforce_budget() == 0ull);
+}
@@ -5,7 +5,15 @@
 #include "hep_concurrency/cache_handle.h"
 #include "interval_of_validity.h"
 
+#include "tbb/parallel_for.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 using namespace hep::concurrency;
 
@@ -95,6 +103,33 @@ TEST_CASE("Copy same handle and then drop unused")
   CHECK(empty(ages));
 }
 
+TEST_CASE("Bounded cleanup")
+{
+  cache<int, int> numbers;
+  for (int i{}; i != 10; ++i) {
+    numbers.emplace(i, i);
+  }
+  auto h = numbers.at(0); // Oldest entry is in use
+
+  CHECK(numbers.drop_unused_but_last(2, 3) == 3ull);
+  CHECK(numbers.size() == 7ull);
+  CHECK(numbers.at(0));
+  CHECK(not numbers.at(1)); // The oldest unused entries are dropped first
+  CHECK(not numbers.at(3));
+  CHECK(numbers.at(4));
+
+  CHECK(numbers.drop_unused_but_last(2, 100) == 4ull);
+  CHECK(numbers.size() == 3ull);
+  CHECK(numbers.at(8));
+  CHECK(numbers.at(9));
+  CHECK(numbers.drop_unused_but_last(2, 100) == 0ull);
+
+  numbers.emplace(10, 10);
+  numbers.emplace(11, 11);
+  CHECK(numbers.unused_keys_but_last(2) == std::vector{8, 9});
+  CHECK(numbers.unused_keys_but_last(4).empty());
+}
+
 TEST_CASE("User defined")
 {
   cache<test::interval_of_validity, std::string> cache;
@@ -178,6 +213,508 @@ TEST_CASE("User defined with hint")
   CHECK(size(cache) == 0ull);
 }
 
+TEST_CASE("Recycle evicted values")
+{
+  cache<int, std::vector<float>> tables;
+  tables.recycle_evicted_values(1);
+  auto fill = [](std::vector<float>& table) { table.assign(1000, 1.5f); };
+
+  float const* buffer{nullptr};
+  {
+    auto h = tables.emplace(1, fill);
+    buffer = h->data();
+  }
+  CHECK(tables.recycled() == 0ull);
+  tables.drop_unused();
+  CHECK(empty(tables));
+  CHECK(tables.recycled() == 1ull);
+
+  // The recycled buffer is reused for the next entry.
+  auto h = tables.emplace(2, [](std::vector<float>& table) {
+    CHECK(table.capacity() == 1000ull);
+    table.assign(500, 2.5f);
+  });
+  CHECK(tables.recycled() == 0ull);
+  CHECK(h->data() == buffer);
+  CHECK(size(*h) == 500ull);
+  CHECK(h->front() == 2.5f);
+
+  // The refill function is not called for an existing key.
+  auto h2 = tables.emplace(2, [](std::vector<float>&) { FAIL(); });
+  CHECK(h2 == h);
+
+  // A failed refill does not leave an entry behind.
+  CHECK_THROWS_AS(tables.emplace(
+                    3,
+                    [](std::vector<float>&) { throw std::runtime_error{""}; }),
+                  std::runtime_error);
+  CHECK(not tables.at(3));
+  CHECK(size(tables) == 1ull);
+}
+
+TEST_CASE("Recycling pool is bounded")
+{
+  cache<int, std::vector<int>> tables;
+  tables.recycle_evicted_values(2);
+  for (int i{}; i != 5; ++i) {
+    tables.emplace(i, std::vector<int>(10, i));
+  }
+  tables.drop_unused();
+  CHECK(empty(tables));
+  CHECK(tables.recycled() == 2ull);
+
+  tables.shrink_to_fit();
+  CHECK(tables.recycled() == 0ull);
+}
+
+TEST_CASE("Front cache")
+{
+  cache<std::string, int> ages;
+  ages.enable_front_cache(4);
+  ages.emplace("Diane", 33);
+  {
+    auto h = ages.at("Diane"); // Populates front cache
+    REQUIRE(h);
+    auto h2 = ages.at("Diane"); // Served by front cache
+    REQUIRE(h2);
+    CHECK(h2 == h);
+    CHECK(*h2 == 33);
+    CHECK(h2.key() == "Diane");
+    ages.drop_unused();
+    CHECK(size(ages) == 1ull);
+  }
+  ages.drop_unused();
+  CHECK(empty(ages));
+  CHECK(not ages.at("Diane")); // Stale slot must not be used
+
+  auto h = ages.emplace("Diane", 34);
+  CHECK(*ages.at("Diane") == 34);
+  CHECK(*ages.at("Diane") == 34);
+  h.invalidate();
+  ages.drop_unused();
+  CHECK(empty(ages));
+
+  ages.emplace("Eve", 21);
+  CHECK(*ages.at("Eve") == 21);
+  ages.shrink_to_fit();
+  CHECK(not ages.at("Eve"));
+}
+
+TEST_CASE("Reserve space for few entries")
+{
+  for (std::size_t const n : {0ull, 1ull, 10ull, 32ull, 33ull}) {
+    cache<int, int> numbers;
+    numbers.reserve(n);
+    numbers.emplace(1, 1);
+    CHECK(numbers.size() == 1ull);
+  }
+}
+
+TEST_CASE("Bulk load")
+{
+  using test::interval_of_validity;
+  std::vector<std::pair<interval_of_validity, std::string>> payload;
+  for (unsigned i{}; i != 1000u; ++i) {
+    payload.emplace_back(interval_of_validity{10 * i, 10 * i + 10},
+                         "Run " + std::to_string(i));
+  }
+
+  cache<interval_of_validity, std::string> cache;
+  cache.emplace({0, 10}, "Already present");
+  cache.reserve(std::size(payload));
+  CHECK(cache.emplace_range(cbegin(payload), cend(payload)) == 999ull);
+  CHECK(size(cache) == 1000ull);
+  CHECK(*cache.entry_for(5) == "Already present");
+
+  // Sequence numbers follow the order of the range.
+  auto h = cache.entry_for(15);
+  CHECK(*h == "Run 1");
+  CHECK(h.sequence_number() == 2ull);
+  CHECK(cache.entry_for(9995).sequence_number() == 1000ull);
+  CHECK(cache.emplace({20000, 20010}, "Next").sequence_number() == 1001ull);
+
+  h.invalidate();
+  cache.drop_unused_but_last(2);
+  CHECK(size(cache) == 2ull);
+  CHECK(cache.entry_for(9995));
+  CHECK(cache.emplace_range(cbegin(payload), cbegin(payload)) == 0ull);
+}
+
+TEST_CASE("Visit live entries")
+{
+  cache<int, int> squares;
+  for (int i{}; i != 100; ++i) {
+    squares.emplace(i, i * i);
+  }
+  {
+    auto h = squares.at(99);
+    squares.drop_unused_but_last(49); // Drops 0 through 49
+  }
+  REQUIRE(squares.size() == 50ull);
+
+  int sum{};
+  unsigned n_visited{};
+  squares.for_each([&](int const key, int const value) {
+    CHECK(value == key * key);
+    CHECK(key >= 50);
+    sum += key;
+    ++n_visited;
+  });
+  CHECK(n_visited == 50u);
+  CHECK(sum == 3725);
+
+  std::atomic<int> parallel_sum{};
+  squares.parallel_for_each(
+    [&parallel_sum](int const key, int) { parallel_sum += key; });
+  CHECK(parallel_sum == 3725);
+
+  std::atomic<int> range_sum{};
+  tbb::parallel_for(squares.range(), [&range_sum](auto const& r) {
+    r.for_each([&range_sum](int const key, int) { range_sum += key; });
+  });
+  CHECK(range_sum == 3725);
+}
+
+TEST_CASE("Advance watermark")
+{
+  using test::interval_of_validity;
+  cache<interval_of_validity, std::string> cache;
+  for (unsigned i{}; i != 10u; ++i) {
+    cache.emplace({10 * i, 10 * i + 10}, "Run " + std::to_string(i));
+  }
+  // Without the index, advancing the watermark has no effect.
+  CHECK(cache.advance_watermark(100) == 0ull);
+  CHECK(size(cache) == 10ull);
+  cache.enable_watermark_index(); // Indexes the existing entries
+
+  auto h = cache.entry_for(15);
+  REQUIRE(h);
+
+  CHECK(cache.advance_watermark(5) == 0ull);
+  CHECK(cache.advance_watermark(10) == 1ull); // [0, 10) expires
+  CHECK(size(cache) == 9ull);
+  CHECK(not cache.entry_for(5));
+
+  // [10, 20) is in use and is retained.
+  CHECK(cache.advance_watermark(35) == 1ull);
+  CHECK(size(cache) == 8ull);
+  CHECK(cache.entry_for(15));
+
+  h.invalidate();
+  CHECK(cache.advance_watermark(35) == 1ull);
+  CHECK(size(cache) == 7ull);
+
+  // Entries dropped by other means are removed from the index.
+  cache.drop_unused_but_last(2);
+  CHECK(size(cache) == 2ull);
+  CHECK(cache.erase_if_unused({80, 90}));
+  CHECK(cache.advance_watermark(100) == 1ull);
+  CHECK(empty(cache));
+
+  // Re-inserted keys are indexed again, once.
+  cache.emplace({0, 10}, "Run 0");
+  cache.drop_unused();
+  cache.emplace({0, 10}, "Run 0");
+  CHECK(cache.advance_watermark(10) == 1ull);
+  CHECK(empty(cache));
+}
+
+namespace {
+  template <typename Key, typename Value, typename T>
+  concept can_advance_watermark =
+    requires(cache<Key, Value> c, T t) { c.advance_watermark(t); };
+}
+
+TEST_CASE("advance_watermark() constraint enforcement")
+{
+  CHECK(can_advance_watermark<test::interval_of_validity, int, unsigned>);
+  CHECK_FALSE(can_advance_watermark<test::interval_of_validity, int, std::string>);
+  CHECK_FALSE(can_advance_watermark<std::string, int, std::string>);
+}
+
+namespace {
+  struct counted_iov {
+    test::interval_of_validity iov;
+    unsigned* n_supports_calls;
+
+    bool
+    supports(unsigned const value) const
+    {
+      ++*n_supports_calls;
+      return iov.supports(value);
+    }
+
+    std::size_t
+    hash() const
+    {
+      return iov.hash();
+    }
+
+    bool
+    operator==(counted_iov const& other) const
+    {
+      return iov == other.iov;
+    }
+  };
+}
+
+TEST_CASE("Negative caching")
+{
+  unsigned n_calls{};
+  cache<counted_iov, std::string> cache;
+  cache.enable_negative_caching();
+  cache.emplace({{0, 10}, &n_calls}, "Run 1");
+  cache.emplace({{20, 30}, &n_calls}, "Run 3");
+
+  CHECK(not cache.entry_for(15u));
+  CHECK(n_calls == 2u);
+  CHECK(not cache.entry_for(15u)); // Remembered miss: no scan
+  CHECK(n_calls == 2u);
+  CHECK(not cache.known_absent(15u)); // Not yet confirmed by user
+
+  cache.mark_absent(15u);
+  CHECK(cache.known_absent(15u));
+  CHECK(not cache.known_absent(16u));
+
+  // Lookups of other values are unaffected.
+  CHECK(*cache.entry_for(25u) == "Run 3");
+
+  // Insertion invalidates remembered misses.
+  cache.emplace({{10, 20}, &n_calls}, "Run 2");
+  CHECK(not cache.known_absent(15u));
+  CHECK(*cache.entry_for(15u) == "Run 2");
+}
+
+TEST_CASE("Negative caching across generations")
+{
+  unsigned n_calls{};
+  cache<counted_iov, std::string> cache;
+  cache.enable_negative_caching(2);
+  cache.emplace({{0, 10}, &n_calls}, "Run 1");
+
+  // Fill the table of misses.
+  CHECK(not cache.entry_for(15u));
+  CHECK(not cache.entry_for(16u));
+  CHECK(not cache.entry_for(17u)); // Beyond capacity: not recorded
+  CHECK(n_calls == 3u);
+  CHECK(not cache.entry_for(16u));
+  CHECK(not cache.entry_for(17u));
+  CHECK(n_calls == 4u);
+
+  // Misses of later generations replace those of earlier ones.
+  for (unsigned i{1u}; i != 5u; ++i) {
+    cache.emplace({{20 * i, 20 * i + 10}, &n_calls}, "Run");
+    auto const value = 20 * i + 15;
+    n_calls = 0u;
+    CHECK(not cache.entry_for(value));
+    CHECK(not cache.entry_for(value + 1));
+    auto const n_scanned = n_calls;
+    CHECK(not cache.entry_for(value));
+    CHECK(not cache.entry_for(value + 1));
+    CHECK(n_calls == n_scanned);
+  }
+}
+
+TEST_CASE("Negative caching disabled")
+{
+  unsigned n_calls{};
+  cache<counted_iov, std::string> cache;
+  cache.emplace({{0, 10}, &n_calls}, "Run 1");
+  CHECK(not cache.entry_for(15u));
+  CHECK(not cache.entry_for(15u));
+  CHECK(n_calls == 2u);
+  cache.mark_absent(15u);
+  CHECK(not cache.known_absent(15u));
+}
+
+TEST_CASE("Compress cold values")
+{
+  using namespace std::chrono_literals;
+  cache<int, std::vector<int>> tables;
+  std::vector<int> sparse(1000, 0);
+  sparse[500] = 7;
+
+  // Without a codec, nothing is compressed.
+  tables.emplace(1, sparse);
+  CHECK(tables.compress_unused(0s) == 0ull);
+
+  tables.set_codec(run_length_codec<int>{});
+  tables.emplace(2, sparse);
+  {
+    auto h = tables.at(2);
+    CHECK(tables.compress_unused(0s) == 1ull); // Only entry 1 is unused
+    CHECK(tables.compressed() == 1ull);
+    CHECK(*h == sparse);
+  }
+  CHECK(tables.compress_unused(1h) == 0ull); // Entry 2 was just accessed
+  CHECK(tables.compress_unused(0s) == 1ull);
+  CHECK(tables.compressed() == 2ull);
+  CHECK(tables.compress_unused(0s) == 0ull); // Already compressed
+
+  // Taking a handle decompresses the value.
+  CHECK(*tables.at(1) == sparse);
+  CHECK(tables.compressed() == 1ull);
+  CHECK(*tables.emplace(2, std::vector<int>{}) == sparse);
+  CHECK(tables.compressed() == 0ull);
+
+  // Compressed entries can be dropped.
+  CHECK(tables.compress_unused(0s) == 2ull);
+  tables.drop_unused();
+  CHECK(empty(tables));
+  CHECK(tables.compressed() == 0ull);
+}
+
+TEST_CASE("Run-length codec")
+{
+  run_length_codec<double> const codec;
+  std::vector<double> const empty_table;
+  CHECK(empty(codec.compress(empty_table)));
+  CHECK(empty(codec.decompress({})));
+
+  std::vector<double> const table{0., 0., 0., 1., 1., -0., 2.};
+  auto const bytes = codec.compress(table);
+  CHECK(size(bytes) == 4 * (sizeof(std::uint32_t) + sizeof(double)));
+  CHECK(codec.decompress(bytes) == table);
+
+  std::span<std::byte const> const truncated{bytes.data(), size(bytes) - 1};
+  CHECK_THROWS_AS(codec.decompress(truncated), cet::exception);
+}
+
+TEST_CASE("Replace value")
+{
+  cache<std::string, std::vector<int>> tables;
+  auto h1 = tables.replace("pedestals", std::vector{1, 2});
+  CHECK(h1.sequence_number() == 0ull);
+
+  auto h2 = tables.replace("pedestals", std::vector{3});
+  CHECK(h2 != h1);
+  CHECK(h2.sequence_number() == 1ull);
+  CHECK(*h1 == std::vector{1, 2}); // Previous version still alive
+  CHECK(*h2 == std::vector{3});
+  CHECK(*tables.at("pedestals") == std::vector{3});
+  CHECK(size(tables) == 1ull);
+  CHECK(tables.retained() == 1ull);
+
+  // The entry cannot be dropped while the previous version is in use.
+  h2.invalidate();
+  tables.drop_unused();
+  CHECK(size(tables) == 1ull);
+
+  h1.invalidate();
+  tables.drop_unused();
+  CHECK(tables.retained() == 0ull);
+  CHECK(empty(tables));
+
+  // Unreferenced versions are released immediately.
+  tables.replace("gains", std::vector{4});
+  tables.replace("gains", std::vector{5});
+  CHECK(tables.retained() == 0ull);
+  CHECK(*tables.at("gains") == std::vector{5});
+}
+
+TEST_CASE("Replace value with front cache")
+{
+  cache<std::string, int> ages;
+  ages.enable_front_cache(4);
+  ages.emplace("Kim", 20);
+  auto h = ages.at("Kim"); // Populates front cache
+  ages.replace("Kim", 21);
+  CHECK(*ages.at("Kim") == 21); // Stale slot must not be used
+  CHECK(*ages.at("Kim") == 21);
+  CHECK(*h == 20);
+}
+
+TEST_CASE("Memory usage")
+{
+  cache<std::string, std::vector<double>> tables;
+  auto const empty_usage = tables.memory_usage();
+  CHECK(empty_usage.keys == 0ull);
+  CHECK(empty_usage.counters == 0ull);
+  CHECK(empty_usage.values == 0ull);
+  CHECK(empty_usage.total() == empty_usage.containers);
+
+  std::string const key(100, 'k'); // Not subject to small-string optimization
+  auto h = tables.emplace(key, std::vector<double>(1000));
+  auto const usage = tables.memory_usage();
+  CHECK(usage.keys >= 2 * (sizeof(std::string) + 100));
+  CHECK(usage.counters > 0ull);
+  CHECK(usage.values >= 1000 * sizeof(double));
+  CHECK(usage.containers > empty_usage.containers);
+  CHECK(usage.total() == usage.containers + usage.keys + usage.counters +
+                           usage.values);
+
+  // User-provided estimate
+  auto const custom = tables.memory_usage(
+    [](std::vector<double> const&) -> std::size_t { return 1; });
+  CHECK(custom.values == sizeof(std::vector<double>) + 1);
+
+  // A retained version is accounted for.
+  tables.replace(key, std::vector<double>(1000));
+  CHECK(tables.memory_usage().values >= 2000 * sizeof(double));
+}
+
+TEST_CASE("Borrowed access")
+{
+  using test::interval_of_validity;
+  cache<interval_of_validity, std::string> runs;
+  runs.emplace({1, 10}, "Run 1");
+
+  std::string seen;
+  auto copy = [&seen](interval_of_validity const&, std::string const& value) {
+    seen = value;
+  };
+  CHECK(runs.visit({1, 10}, copy));
+  CHECK(seen == "Run 1");
+  CHECK(not runs.visit({2, 10}, copy));
+
+  seen.clear();
+  CHECK(runs.visit_for(5u, copy));
+  CHECK(seen == "Run 1");
+  CHECK(not runs.visit_for(10u, copy));
+
+  // Visiting does not pin the entry.
+  runs.drop_unused();
+  CHECK(runs.empty());
+}
+
+TEST_CASE("Open-addressing backend")
+{
+  cache<std::string, int, open_addressing_backend<8>> ages;
+  CHECK(ages.capacity() == 0ull);
+  auto h = ages.emplace("Liam", 30);
+  CHECK(*ages.emplace("Liam", 31) == 30);
+  ages.emplace("Mia", 40);
+  CHECK(*ages.at("Mia") == 40);
+  CHECK(not ages.at("Noah"));
+  CHECK(size(ages) == 2ull);
+
+  // Tombstones are reused, and removed by shrink_to_fit().
+  ages.drop_unused();
+  CHECK(size(ages) == 1ull);
+  CHECK(not ages.at("Mia"));
+  ages.emplace("Mia", 41);
+  CHECK(*ages.at("Mia") == 41);
+  h.invalidate();
+  ages.shrink_to_fit();
+  CHECK(empty(ages));
+
+  // At most 7/8 of the slots can be used without reserving space.
+  for (int i{}; i != 7; ++i) {
+    ages.emplace(std::to_string(i), i);
+  }
+  CHECK_THROWS_AS(ages.emplace("7", 7), cet::exception);
+  ages.reserve(100);
+  ages.emplace("7", 7);
+  CHECK(size(ages) == 8ull);
+  for (int i{}; i != 8; ++i) {
+    CHECK(*ages.at(std::to_string(i)) == i);
+  }
+
+  // The footprint accounts for the (at least 100) reserved slots.
+  using backend = open_addressing_backend<8>;
+  CHECK(ages.memory_usage().containers >= 100 * backend::map_bucket_bytes);
+}
+
 namespace {
   template <typename Key, typename Value>
   concept can_cache = requires { { cache<Key, Value>{} }; };
@@ -198,6 +735,23 @@ namespace {
 
 }
 
+TEST_CASE("Open-addressing backend under churn")
+{
+  // Erasure removes tombstones, so inserting and dropping many more
+  // entries than there are slots does not fill the map.
+  cache<unsigned, unsigned, open_addressing_backend<64>> numbers;
+  auto const h = numbers.emplace(0u, 0u);
+  for (unsigned i{1u}; i != 10'000u; ++i) {
+    numbers.emplace(i, i);
+    if (i % 3u == 0u) {
+      numbers.drop_unused();
+    }
+  }
+  numbers.drop_unused();
+  CHECK(numbers.size() == 1ull);
+  CHECK(*numbers.at(0u) == 0u);
+}
+
 TEST_CASE("Cache constraint enforcement")
 {
   CHECK_FALSE(can_cache<not_hashable, int>);
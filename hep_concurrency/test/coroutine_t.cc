@@ -0,0 +1,116 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "hep_concurrency/coroutine.h"
+#include "hep_concurrency/WaitingTask.h"
+
+#include "tbb/task_group.h"
+
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <vector>
+
+using namespace hep::concurrency;
+
+namespace {
+  task<int>
+  answer()
+  {
+    co_return 42;
+  }
+
+  task<int>
+  no_answer()
+  {
+    throw std::runtime_error("No answer");
+    co_return 0;
+  }
+
+  task<void>
+  ask(int& result, bool& failed)
+  {
+    result = co_await answer();
+    try {
+      co_await no_answer();
+    }
+    catch (std::runtime_error const&) {
+      failed = true;
+    }
+  }
+
+  struct serial_counters {
+    unsigned count{};              // Modified only on the queue
+    std::atomic<unsigned> running{};
+    std::atomic<unsigned> overlaps{};
+    std::atomic<unsigned> finished{};
+  };
+
+  task<void>
+  count_serially(SerialTaskQueue& queue,
+                 tbb::task_group& group,
+                 serial_counters& counters)
+  {
+    co_await queue.schedule();
+    if (counters.running++ != 0u) {
+      ++counters.overlaps;
+    }
+    ++counters.count;
+    --counters.running;
+    co_await schedule(group);
+    ++counters.finished;
+  }
+}
+
+TEST_CASE("Await tasks")
+{
+  tbb::task_group group;
+  int result{};
+  bool failed{false};
+  auto const done = spawn(group, ask(result, failed));
+  group.wait();
+  CHECK(result == 42);
+  CHECK(failed);
+}
+
+TEST_CASE("Resume coroutines on a serial queue")
+{
+  tbb::task_group group;
+  SerialTaskQueue queue{group};
+  serial_counters counters;
+  constexpr auto n_tasks = 1000u;
+  std::vector<std::shared_ptr<WaitingTaskList>> done;
+  for (unsigned int i = 0; i != n_tasks; ++i) {
+    done.push_back(spawn(group, count_serially(queue, group, counters)));
+  }
+  group.wait();
+  CHECK(counters.count == n_tasks);
+  CHECK(counters.overlaps == 0u);
+  CHECK(counters.finished == n_tasks);
+}
+
+TEST_CASE("Propagate exceptions from spawned tasks")
+{
+  tbb::task_group group;
+  SerialTaskQueue queue{group};
+  queue.pause();
+  auto const done = spawn(group, [](SerialTaskQueue& q) -> task<void> {
+    co_await q.schedule();
+    throw std::runtime_error("Serial step failed");
+  }(queue));
+
+  std::exception_ptr received;
+  std::atomic<unsigned> n_calls{};
+  done->add(
+    make_waiting_task([&received, &n_calls](std::exception_ptr ex_ptr) {
+      received = ex_ptr;
+      ++n_calls;
+    }));
+  group.wait();
+  CHECK(n_calls == 0u); // The coroutine waits for the queue.
+
+  queue.resume();
+  group.wait();
+  CHECK(n_calls == 1u);
+  REQUIRE(received);
+  CHECK_THROWS_AS(std::rethrow_exception(received), std::runtime_error);
+}
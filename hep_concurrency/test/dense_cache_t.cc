@@ -0,0 +1,134 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "cetlib_except/exception_message_matcher.h"
+#include "hep_concurrency/cache.h"
+
+#include "tbb/parallel_for.h"
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+using namespace hep::concurrency;
+using Catch::Matchers::ContainsSubstring;
+
+namespace {
+  struct channel_id {
+    unsigned value;
+
+    bool
+    supports(unsigned const channel) const
+    {
+      return channel == value;
+    }
+
+    std::size_t
+    hash() const
+    {
+      return value;
+    }
+
+    bool operator==(channel_id const&) const = default;
+  };
+}
+
+template <>
+struct hep::concurrency::dense_key_traits<channel_id> {
+  static constexpr std::size_t extent = 64;
+  static std::size_t
+  index(channel_id const id)
+  {
+    return id.value;
+  }
+};
+
+TEST_CASE("Dense backend selects array-backed cache")
+{
+  // The traits alone do not select the dense implementation.
+  CHECK(cache<channel_id, int>{}.capacity() == 0ull);
+
+  cache<channel_id, std::string, dense_backend> cache;
+  CHECK(cache.capacity() == 64ull);
+  CHECK(cache.empty());
+  CHECK(not cache.at({3}));
+
+  auto h = cache.emplace({3}, "Channel 3");
+  CHECK(cache.size() == 1ull);
+  CHECK(h.key().value == 3u);
+  CHECK(*h == "Channel 3");
+  CHECK(h.sequence_number() == 0ull);
+  CHECK(cache.emplace({3}, "Ignored") == h);
+  CHECK(cache.at({3}) == h);
+  CHECK(cache.entry_for(3u) == h);
+  CHECK(cache.entry_for(h, 3u) == h);
+  CHECK(not cache.entry_for(4u));
+
+  cache.drop_unused();
+  CHECK(cache.size() == 1ull);
+  h.invalidate();
+  cache.drop_unused();
+  CHECK(cache.empty());
+  CHECK(not cache.at({3}));
+}
+
+TEST_CASE("Dense cache retention")
+{
+  cache<channel_id, int, dense_backend> cache;
+  for (unsigned i{}; i != 10u; ++i) {
+    cache.emplace({i}, static_cast<int>(i));
+  }
+  cache.drop_unused_but_last(3);
+  CHECK(cache.size() == 3ull);
+  CHECK(not cache.at({6}));
+  CHECK(*cache.at({7}) == 7);
+  CHECK(*cache.at({9}) == 9);
+
+  cache.shrink_to_fit();
+  CHECK(cache.empty());
+}
+
+TEST_CASE("Dense cache key outside of domain")
+{
+  cache<channel_id, int, dense_backend> cache;
+  CHECK(not cache.at({64}));
+  CHECK_THROWS_MATCHES(
+    cache.emplace({64}, 1),
+    cet::exception,
+    cet::exception_message_matcher(ContainsSubstring("dense key domain")));
+}
+
+TEST_CASE("Dense cache (multi-threaded)")
+{
+  cache<channel_id, unsigned, dense_backend> cache;
+  std::atomic<unsigned> n_correct{};
+  tbb::parallel_for(0u, 6400u, [&cache, &n_correct](unsigned const i) {
+    auto const channel = i % 64;
+    auto h = cache.at({channel});
+    if (not h) {
+      h = cache.emplace({channel}, channel);
+    }
+    if (*h == channel) {
+      ++n_correct;
+    }
+    if (i % 7 == 0) {
+      cache.drop_unused_but_last(8);
+    }
+  });
+  CHECK(n_correct == 6400u);
+}
+
+TEST_CASE("Dense cache borrowed access")
+{
+  cache<channel_id, int, dense_backend> cache;
+  cache.emplace({5}, 50);
+  int seen{};
+  auto copy = [&seen](channel_id const&, int const value) { seen = value; };
+  CHECK(cache.visit({5}, copy));
+  CHECK(seen == 50);
+  CHECK(not cache.visit({6}, copy));
+  CHECK(not cache.visit({64}, copy));
+  seen = 0;
+  CHECK(cache.visit_for(5u, copy));
+  CHECK(seen == 50);
+  CHECK(not cache.visit_for(6u, copy));
+}
@@ -28,6 +28,12 @@ namespace hep::concurrency::test {
              iov.range_.second <= range_.second;
     }
 
+    unsigned int
+    upper_bound() const noexcept
+    {
+      return range_.second;
+    }
+
     bool
     operator==(interval_of_validity const& other) const noexcept
     {
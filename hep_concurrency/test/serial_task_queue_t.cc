@@ -9,10 +9,50 @@
 // each task, we may make use of the macros here.
 
 #include "hep_concurrency/SerialTaskQueue.h"
+#include "tbb/parallel_invoke.h"
 
+#include <array>
 #include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
 #include <thread>
 
+// The replacement allocation functions are not inlined, so that the
+// compiler does not flag calls to std::free for memory obtained from
+// operator new.
+namespace {
+  // Counts the allocations made by the current thread while enabled.
+  thread_local bool count_allocations{false};
+  thread_local unsigned int n_allocations{0u};
+}
+
+[[gnu::noinline]] void*
+operator new(std::size_t const size)
+{
+  if (count_allocations) {
+    ++n_allocations;
+  }
+  if (auto* p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc{};
+}
+
+[[gnu::noinline]] void
+operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+[[gnu::noinline]] void
+operator delete(void* p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
 TEST_CASE("Push entries")
 {
   tbb::task_group group;
@@ -66,3 +106,316 @@ TEST_CASE("Stress the queue from multiple threads")
     CHECK(2 * n_tasks == count);
   }
 }
+
+TEST_CASE("Pause and resume while pushing from multiple threads")
+{
+  tbb::task_group group;
+  hep::concurrency::SerialTaskQueue queue{group};
+  constexpr auto n_tasks = 10000u;
+  std::atomic count{0u};
+  std::atomic running{0u};
+  std::atomic overlaps{0u};
+  std::atomic unmatched{0u};
+  auto push_tasks = [&queue, &count, &running, &overlaps] {
+    for (unsigned int i = 0; i != n_tasks; ++i) {
+      queue.push([&count, &running, &overlaps] {
+        if (running++ != 0u) {
+          ++overlaps;
+        }
+        ++count;
+        --running;
+      });
+    }
+  };
+  auto pause_and_resume = [&queue, &unmatched] {
+    for (unsigned int i = 0; i != 1000u; ++i) {
+      if (not queue.pause() or not queue.resume()) {
+        ++unmatched;
+      }
+    }
+  };
+
+  tbb::parallel_invoke(push_tasks, push_tasks, pause_and_resume);
+  group.wait();
+  CHECK(count == 2 * n_tasks);
+  CHECK(overlaps == 0u);
+  CHECK(unmatched == 0u);
+}
+
+TEST_CASE("Push move-only tasks")
+{
+  tbb::task_group group;
+  hep::concurrency::SerialTaskQueue queue{group};
+  auto sum = 0;
+  for (int i = 0; i != 10; ++i) {
+    queue.push([&sum, p = std::make_unique<int>(i)] { sum += *p; });
+  }
+  // Larger than the in-place buffer of a task
+  std::array<int, 32> values{};
+  values.fill(1);
+  queue.push([&sum, values] {
+    for (auto const v : values) {
+      sum += v;
+    }
+  });
+  group.wait();
+  CHECK(sum == 45 + 32);
+}
+
+TEST_CASE("Pushing small tasks does not allocate")
+{
+  tbb::task_group group;
+  hep::concurrency::SerialTaskQueue queue{group};
+  constexpr auto n_tasks = 100u;
+  auto count = 0u;
+  auto push_tasks = [&queue, &count] {
+    for (unsigned int i = 0; i != n_tasks; ++i) {
+      queue.push([&count, i] { count += i % 2; });
+    }
+  };
+
+  // Fill the node pool
+  queue.pause();
+  push_tasks();
+  queue.resume();
+  group.wait();
+
+  queue.pause();
+  count_allocations = true;
+  push_tasks();
+  count_allocations = false;
+  CHECK(n_allocations == 0u);
+  queue.resume();
+  group.wait();
+  CHECK(count == n_tasks);
+}
+
+TEST_CASE("Execute tasks inline")
+{
+  using namespace std::chrono_literals;
+  tbb::task_group group;
+  hep::concurrency::SerialTaskQueue queue{
+    group, {.max_tasks = 1000u, .max_time = 1s, .run_on_push = true}};
+
+  // Pushed from outside of a TBB task: not executed directly
+  auto count = 0u;
+  queue.push([&count] { ++count; });
+  CHECK(count == 0u);
+  group.wait();
+  CHECK(count == 1u);
+
+  // Pushed from within a TBB task onto an idle queue: executed before
+  // push returns.  Tasks pushed by that task are not.
+  hep::concurrency::SerialTaskQueue other{
+    group, {.max_tasks = 0u, .run_on_push = true}};
+  auto nested = 0u;
+  group.run([&] {
+    queue.push([&] {
+      ++count;
+      other.push([&nested] { ++nested; });
+      CHECK(nested == 0u);
+    });
+    CHECK(count == 2u);
+  });
+  group.wait();
+  CHECK(nested == 1u);
+
+  // Pausing the queue stops inline execution.
+  constexpr auto n_tasks = 100u;
+  queue.pause();
+  for (unsigned int i = 0; i != n_tasks; ++i) {
+    queue.push([&queue, &count] {
+      if (++count == 50u) {
+        queue.pause();
+      }
+    });
+  }
+  queue.resume();
+  group.wait();
+  CHECK(count == 50u);
+  queue.resume();
+  group.wait();
+  CHECK(count == n_tasks + 2u);
+}
+
+TEST_CASE("Execute tasks inline while pushing from multiple threads")
+{
+  tbb::task_group group;
+  hep::concurrency::SerialTaskQueue queue{group, {.max_tasks = 8u}};
+  queue.enable_metrics("inline");
+  constexpr auto n_tasks = 10000u;
+  std::atomic count{0u};
+  std::atomic running{0u};
+  std::atomic overlaps{0u};
+  auto push_tasks = [&queue, &count, &running, &overlaps] {
+    for (unsigned int i = 0; i != n_tasks; ++i) {
+      queue.push([&count, &running, &overlaps] {
+        if (running++ != 0u) {
+          ++overlaps;
+        }
+        ++count;
+        --running;
+      });
+    }
+  };
+  auto pause_and_resume = [&queue] {
+    for (unsigned int i = 0; i != 1000u; ++i) {
+      queue.pause();
+      queue.resume();
+    }
+  };
+
+  tbb::parallel_invoke(push_tasks, push_tasks, pause_and_resume);
+  group.wait();
+  CHECK(count == 2 * n_tasks);
+  CHECK(overlaps == 0u);
+
+  auto const metrics = queue.metrics();
+  CHECK(metrics.depth == 0u);
+  CHECK(metrics.wait_time.count() == 2 * n_tasks);
+  CHECK(metrics.run_time.count() == 2 * n_tasks);
+  CHECK(metrics.pause_time.count() <= 1000u);
+}
+
+TEST_CASE("Push tasks with priorities")
+{
+  using hep::concurrency::task_priority;
+  tbb::task_group group;
+  hep::concurrency::SerialTaskQueue queue{group};
+  std::string order;
+  auto record = [&order](char const c) { return [&order, c] { order += c; }; };
+
+  queue.pause();
+  queue.push(record('a'), task_priority::low);
+  queue.push(record('b'));
+  queue.push(record('C'), task_priority::high);
+  queue.push(record('d'), task_priority::low);
+  queue.push(record('E'), task_priority::high);
+  queue.push(record('f'));
+  queue.resume();
+  group.wait();
+  CHECK(order == "CEbfad");
+}
+
+TEST_CASE("Age low-priority tasks")
+{
+  using hep::concurrency::task_priority;
+  tbb::task_group group;
+  hep::concurrency::SerialTaskQueue queue{group};
+  queue.enable_aging(2u);
+  std::string order;
+  auto record = [&order](char const c) { return [&order, c] { order += c; }; };
+
+  queue.pause();
+  queue.push(record('a'), task_priority::low);
+  queue.push(record('b'), task_priority::low);
+  for (char c = 'A'; c != 'G'; ++c) {
+    queue.push(record(c), task_priority::high);
+  }
+  queue.resume();
+  group.wait();
+  CHECK(order == "ABaCDbEF");
+}
+
+TEST_CASE("Track the completion of tasks")
+{
+  using namespace hep::concurrency;
+  tbb::task_group group;
+  SerialTaskQueue queue{group};
+  queue.pause();
+
+  auto count = 0u;
+  auto const first = queue.push_tracked([&count] { ++count; });
+  auto const second = queue.push_tracked(
+    [] { throw std::runtime_error("Serial task failed"); });
+
+  // Downstream tasks wait for the serial task, and receive its
+  // exception.
+  std::atomic<unsigned> n_calls{};
+  std::exception_ptr first_ex_ptr;
+  std::exception_ptr second_ex_ptr;
+  first->add(
+    make_waiting_task([&n_calls, &first_ex_ptr](std::exception_ptr ex_ptr) {
+      first_ex_ptr = ex_ptr;
+      ++n_calls;
+    }));
+  second->add(
+    make_waiting_task([&n_calls, &second_ex_ptr](std::exception_ptr ex_ptr) {
+      second_ex_ptr = ex_ptr;
+      ++n_calls;
+    }));
+  group.wait();
+  CHECK(n_calls == 0u);
+
+  queue.resume();
+  group.wait();
+  CHECK(count == 1u);
+  CHECK(n_calls == 2u);
+  CHECK(not first_ex_ptr);
+  REQUIRE(second_ex_ptr);
+  CHECK_THROWS_AS(std::rethrow_exception(second_ex_ptr), std::runtime_error);
+
+  // Tasks added after completion are spawned immediately.
+  first->add(make_waiting_task([&n_calls](std::exception_ptr) { ++n_calls; }));
+  group.wait();
+  CHECK(n_calls == 3u);
+}
+
+TEST_CASE("Duration histogram")
+{
+  using namespace std::chrono_literals;
+  using hep::concurrency::duration_histogram;
+  static_assert(duration_histogram::bin(0ns) == 0u);
+  static_assert(duration_histogram::bin(1ns) == 1u);
+  static_assert(duration_histogram::bin(1000ns) == 10u);
+  static_assert(duration_histogram::upper_bound(10u) == 1024ns);
+  static_assert(duration_histogram::bin(1000h) ==
+                duration_histogram::n_bins - 1);
+
+  duration_histogram h;
+  CHECK(h.percentile(0.5) == 0ns);
+  for (auto const d : {3ns, 100ns, 120ns, 5000ns}) {
+    ++h.counts[duration_histogram::bin(d)];
+    h.total += d;
+  }
+  CHECK(h.count() == 4ull);
+  CHECK(h.mean() == 1305ns);
+  CHECK(h.percentile(0.) == 4ns);
+  CHECK(h.percentile(0.5) == 128ns);
+  CHECK(h.percentile(1.) == 8192ns);
+}
+
+TEST_CASE("Collect queue metrics")
+{
+  using namespace std::chrono_literals;
+  tbb::task_group group;
+  hep::concurrency::SerialTaskQueue queue{group};
+  CHECK(not queue.metrics_enabled());
+  CHECK(queue.metrics().name.empty());
+
+  queue.enable_metrics("output");
+  CHECK(queue.metrics_enabled());
+  queue.pause();
+  constexpr auto n_tasks = 10u;
+  for (unsigned int i = 0; i != n_tasks; ++i) {
+    queue.push([] { std::this_thread::sleep_for(1ms); });
+  }
+  auto metrics = queue.metrics();
+  CHECK(metrics.name == "output");
+  CHECK(metrics.depth == n_tasks);
+  CHECK(metrics.max_depth == n_tasks);
+  CHECK(metrics.wait_time.count() == 0ull);
+
+  std::this_thread::sleep_for(1ms);
+  queue.resume();
+  group.wait();
+  metrics = queue.metrics();
+  CHECK(metrics.depth == 0u);
+  CHECK(metrics.max_depth == n_tasks);
+  CHECK(metrics.wait_time.count() == n_tasks);
+  CHECK(metrics.wait_time.percentile(0.) >= 1ms);
+  CHECK(metrics.run_time.count() == n_tasks);
+  CHECK(metrics.run_time.mean() >= 1ms);
+  CHECK(metrics.pause_time.count() == 1ull);
+  CHECK(metrics.pause_time.total >= 1ms);
+}
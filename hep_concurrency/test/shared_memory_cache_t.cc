@@ -0,0 +1,204 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_string.hpp>
+
+#include "hep_concurrency/shared_memory_cache.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace hep::concurrency;
+using Catch::Matchers::ContainsSubstring;
+
+namespace {
+  struct iov {
+    unsigned start;
+    unsigned stop;
+  };
+
+  // Each test case uses its own segment, which is removed on exit.
+  class segment_name {
+  public:
+    explicit segment_name(std::string const& test)
+      : name_{"/hep_concurrency_" + test + "_" + std::to_string(::getpid())}
+    {
+      shared_memory_cache<int, int>::remove(name_);
+    }
+    ~segment_name() { shared_memory_cache<int, int>::remove(name_); }
+    operator std::string const&() const { return name_; }
+
+  private:
+    std::string name_;
+  };
+}
+
+TEST_CASE("Shared memory cache")
+{
+  segment_name const name{"shm_t"};
+  shared_memory_options const options{.max_entries = 4, .data_bytes = 4096};
+  shared_memory_cache<iov, float> first{name, options};
+  shared_memory_cache<iov, float> second{name, options}; // Same segment
+
+  CHECK(not first.at({1, 2}));
+  std::vector<float> const pedestals{1.f, 2.f, 3.f};
+  auto h = first.emplace(iov{1, 2}, pedestals);
+  REQUIRE(h);
+  CHECK(h.key().stop == 2u);
+  CHECK(first.size() == 1ull);
+  CHECK(first.bytes_used() == 64ull);
+
+  int n_loads{};
+  auto h2 = second.emplace(iov{1, 2}, [&n_loads] {
+    ++n_loads;
+    return std::vector<float>{};
+  });
+  CHECK(n_loads == 0); // Already loaded through the other mapping
+  REQUIRE(h2);
+  auto const values = *h2;
+  CHECK(std::vector(begin(values), end(values)) == pedestals);
+  CHECK(second.size() == 1ull);
+
+  // The entry is referenced through both mappings.
+  CHECK(second.drop_unused() == 0ull);
+  h.invalidate();
+  auto h3 = h2;
+  h2.invalidate();
+  CHECK(first.drop_unused() == 0ull);
+  h3.invalidate();
+  CHECK(first.drop_unused() == 1ull);
+  CHECK(not second.at({1, 2}));
+  CHECK(second.size() == 0ull);
+  CHECK(second.bytes_used() == 0ull);
+
+  // A failed load leaves the key absent.
+  CHECK_THROWS_AS(second.emplace(iov{2, 3},
+                                 []() -> std::vector<float> {
+                                   throw std::runtime_error("No payload");
+                                 }),
+                  std::runtime_error);
+  CHECK(not first.at({2, 3}));
+  CHECK(first.emplace(iov{2, 3}, std::vector<float>(16, 1.f)));
+
+  // At most max_entries entries are held at a time.
+  CHECK(first.emplace(iov{3, 4}, std::vector<float>(1)));
+  CHECK(first.emplace(iov{4, 5}, std::vector<float>(1)));
+  CHECK(first.emplace(iov{5, 6}, std::vector<float>(1)));
+  CHECK_THROWS_WITH(first.emplace(iov{6, 7}, std::vector<float>(1)),
+                    ContainsSubstring("maximum number of entries"));
+
+  // The index slots of removed entries are reused.
+  CHECK(first.drop_unused() == 4ull);
+  for (unsigned i{10u}; i != 100u; ++i) {
+    CHECK(first.emplace(iov{i, i + 1}, std::vector<float>(1)));
+    CHECK(second.drop_unused() == 1ull);
+  }
+  CHECK(first.emplace(iov{1, 2}, pedestals));
+  CHECK(second.size() == 1ull);
+
+  CHECK_THROWS_WITH((shared_memory_cache<iov, double>{name, options}),
+                    ContainsSubstring("another type"));
+  CHECK_THROWS_WITH((shared_memory_cache<iov, float>{name, {.max_entries = 8}}),
+                    ContainsSubstring("different options"));
+}
+
+TEST_CASE("Shared memory cache data reuse")
+{
+  segment_name const name{"shm_reuse_t"};
+  shared_memory_cache<int, char> buffers{
+    name, {.max_entries = 16, .data_bytes = 256}};
+  CHECK(buffers.emplace(1, std::vector<char>(100)));
+  CHECK(buffers.emplace(2, std::vector<char>(100)));
+  CHECK_THROWS_WITH(buffers.emplace(3, std::vector<char>(100)),
+                    ContainsSubstring("exhausted"));
+  CHECK(buffers.drop_unused() == 2ull);
+  // The freed blocks are reused.
+  CHECK(buffers.emplace(3, std::vector<char>(100)));
+  CHECK(buffers.emplace(4, std::vector<char>(128)));
+  CHECK(buffers.bytes_used() == 256ull);
+}
+
+TEST_CASE("Shared memory cache (multi-threaded)")
+{
+  segment_name const name{"shm_mt_t"};
+  shared_memory_cache<int, int> numbers{name, {.max_entries = 64}};
+  std::atomic<int> n_loads{};
+  std::atomic<int> n_mismatches{};
+  std::vector<std::thread> threads;
+  for (int t{}; t != 8; ++t) {
+    threads.emplace_back([&numbers, &n_loads, &n_mismatches] {
+      for (int i{}; i != 32; ++i) {
+        auto h = numbers.emplace(i, [&n_loads, i] {
+          ++n_loads;
+          return std::vector<int>(4, i);
+        });
+        if (not h or (*h)[3] != i) {
+          ++n_mismatches;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  CHECK(n_mismatches == 0);
+  CHECK(n_loads == 32);
+  CHECK(numbers.size() == 32ull);
+}
+
+TEST_CASE("Shared memory cache across processes")
+{
+  segment_name const name{"shm_fork_t"};
+  shared_memory_cache<int, int> numbers{name};
+
+  auto const pid = ::fork();
+  REQUIRE(pid != -1);
+  if (pid == 0) {
+    shared_memory_cache<int, int> child_numbers{name};
+    auto h = child_numbers.emplace(7, std::vector<int>{1, 2, 3});
+    h.invalidate();
+    ::_exit(child_numbers.size() == 1ull ? 0 : 1);
+  }
+  int status{};
+  REQUIRE(::waitpid(pid, &status, 0) == pid);
+  REQUIRE(WIFEXITED(status));
+  CHECK(WEXITSTATUS(status) == 0);
+
+  auto h = numbers.at(7);
+  REQUIRE(h);
+  CHECK((*h).size() == 3ull);
+  CHECK((*h)[2] == 3);
+}
+
+TEST_CASE("Shared memory cache load by a terminated process")
+{
+  segment_name const name{"shm_crash_t"};
+  shared_memory_cache<int, int> numbers{name};
+
+  auto const pid = ::fork();
+  REQUIRE(pid != -1);
+  if (pid == 0) {
+    shared_memory_cache<int, int> child_numbers{name};
+    child_numbers.emplace(7, []() -> std::vector<int> { ::_exit(0); });
+    ::_exit(1);
+  }
+  int status{};
+  REQUIRE(::waitpid(pid, &status, 0) == pid);
+  REQUIRE(WIFEXITED(status));
+  REQUIRE(WEXITSTATUS(status) == 0); // Terminated while loading
+
+  CHECK(not numbers.at(7));
+  int n_loads{};
+  auto h = numbers.emplace(7, [&n_loads] {
+    ++n_loads;
+    return std::vector<int>{1, 2, 3};
+  });
+  CHECK(n_loads == 1);
+  REQUIRE(h);
+  CHECK((*h).size() == 3ull);
+  CHECK(numbers.size() == 1ull);
+}